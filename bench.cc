@@ -0,0 +1,278 @@
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <chrono>
+#include <cstdlib>
+#include <sys/resource.h>
+
+#include "dlog.hh"
+#include "dsl.hh"
+#include "typed.hh"
+
+// Synthetic workloads for measuring changes to relation, join() and eval(). Usage:
+//
+//   bench [workload|all] [size] [threads] [pairwise|leapfrog]
+//
+// 'size' is the number of input tuples (default 1000). Output sizes grow faster than
+// that for the closure workloads (tc-chain derives size^2/2 tuples). Peak RSS is per
+// process, run one workload per invocation when comparing memory.
+
+struct workload
+{
+	std::string name, query;
+	std::multimap<std::string,rule_ptr> idb;
+	std::map<std::string,rel_ptr> edb;
+};
+
+// times each stratum
+class phases : public tracer
+{
+public:
+	virtual void stratum(const std::set<std::string> &preds)
+	{
+		m_start = std::chrono::steady_clock::now();
+		m_names.push_back(std::string());
+		for(const std::string &s: preds)
+			m_names.back() += (m_names.back().empty() ? "" : ",") + s;
+	}
+
+	virtual void stratum_finish(const std::set<std::string> &)
+	{
+		m_seconds.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count());
+	}
+
+	std::vector<std::string> m_names;
+	std::vector<double> m_seconds;
+
+private:
+	std::chrono::steady_clock::time_point m_start;
+};
+
+void add(workload &w, parse &p)
+{
+	for(rule_ptr r: p.rules)
+		w.idb.insert(std::make_pair(r->head.name,r));
+}
+
+rel_ptr facts(workload &w, const std::string &name)
+{
+	rel_ptr &r = w.edb[name];
+
+	if(!r)
+		r = rel_ptr(new relation());
+	return r;
+}
+
+void fact(rel_ptr r, unsigned int a)
+{
+	typed_relation<unsigned int>(r).insert(a);
+}
+
+void fact(rel_ptr r, unsigned int a, unsigned int b)
+{
+	typed_relation<unsigned int,unsigned int>(r).insert(a,b);
+}
+
+// path(X,Y) :- edge(X,Y). path(X,Y) :- edge(X,Z),path(Z,Y).
+void transitive_closure(workload &w)
+{
+	parse edge("edge"), path("path");
+
+	path("X"_dl,"Y"_dl) << edge("X"_dl,"Y"_dl);
+	path("X"_dl,"Y"_dl) << edge("X"_dl,"Z"_dl),path("Z"_dl,"Y"_dl);
+
+	add(w,path);
+	w.query = "path";
+}
+
+void tc_chain(workload &w, unsigned int n, std::mt19937 &)
+{
+	rel_ptr edge = facts(w,"edge");
+	unsigned int i = 0;
+
+	while(i < n)
+	{
+		fact(edge,i,i + 1);
+		++i;
+	}
+
+	transitive_closure(w);
+}
+
+// sparse random graph w/ n edges over n nodes
+void tc_random(workload &w, unsigned int n, std::mt19937 &rng)
+{
+	rel_ptr edge = facts(w,"edge");
+	std::uniform_int_distribution<unsigned int> node(0,n - 1);
+	const size_t edges = std::min<size_t>(n,size_t(n) * n); // distinct edges possible
+
+	while(edge->rows().size() < edges)
+		fact(edge,node(rng),node(rng));
+
+	transitive_closure(w);
+}
+
+// same generation on a random tree w/ n parent edges
+void same_generation(workload &w, unsigned int n, std::mt19937 &rng)
+{
+	rel_ptr parent = facts(w,"parent");
+	unsigned int i = 1;
+
+	while(i <= n)
+	{
+		fact(parent,i,std::uniform_int_distribution<unsigned int>(std::max(i,8u) - 8,i - 1)(rng));
+		++i;
+	}
+
+	parse par("parent"), sg("sg");
+
+	sg("X"_dl,"Y"_dl) << par("X"_dl,"P"_dl),par("Y"_dl,"P"_dl);
+	sg("X"_dl,"Y"_dl) << par("X"_dl,"A"_dl),sg("A"_dl,"B"_dl),par("Y"_dl,"B"_dl);
+
+	add(w,sg);
+	w.query = "sg";
+}
+
+// Andersen style points-to analysis over n/4 statements of each kind. variables and
+// heap objects share one id space.
+void andersen(workload &w, unsigned int n, std::mt19937 &rng)
+{
+	rel_ptr addr = facts(w,"addressOf"), assign = facts(w,"assign"), load = facts(w,"load"), store = facts(w,"store");
+	std::uniform_int_distribution<unsigned int> var(0,std::max(n,1u));
+	unsigned int i = 0;
+
+	while(i < n / 4 + 1)
+	{
+		fact(addr,var(rng),var(rng));
+		fact(assign,var(rng),var(rng));
+		fact(load,var(rng),var(rng));
+		fact(store,var(rng),var(rng));
+		++i;
+	}
+
+	parse addressOf("addressOf"), as("assign"), ld("load"), st("store"), pt("pointsTo");
+
+	pt("Y"_dl,"X"_dl) << addressOf("Y"_dl,"X"_dl);
+	pt("Y"_dl,"X"_dl) << as("Y"_dl,"Z"_dl),pt("Z"_dl,"X"_dl);
+	pt("Y"_dl,"W"_dl) << ld("Y"_dl,"X"_dl),pt("X"_dl,"Z"_dl),pt("Z"_dl,"W"_dl);
+	pt("Z"_dl,"W"_dl) << st("Y"_dl,"X"_dl),pt("Y"_dl,"Z"_dl),pt("X"_dl,"W"_dl);
+
+	add(w,pt);
+	w.query = "pointsTo";
+}
+
+// win/lose game on a random DAG w/ n moves. every stratum above the first negates the one below.
+void game(workload &w, unsigned int n, std::mt19937 &rng)
+{
+	rel_ptr move = facts(w,"move"), node = facts(w,"node");
+	const unsigned int nodes = std::max(n / 2,2u);
+	size_t edges = 0; // distinct moves possible, small sizes have fewer than n
+	unsigned int i = 0;
+
+	while(i < nodes - 1)
+		edges += std::min(16u,nodes - 1 - i++);
+	edges = std::min<size_t>(edges,n);
+	i = 0;
+
+	while(move->rows().size() < edges)
+	{
+		unsigned int a = std::uniform_int_distribution<unsigned int>(0,nodes - 2)(rng);
+		fact(move,a,std::uniform_int_distribution<unsigned int>(a + 1,std::min(a + 16,nodes - 1))(rng));
+	}
+
+	while(i < nodes)
+		fact(node,i++);
+
+	parse mv("move"), nd("node"), canMove("canMove"), lost("lost"), winning("winning"), open("open"), reach("reach"), reachLost("reachLost"), doomed("doomed");
+
+	canMove("X"_dl) << mv("X"_dl,"Y"_dl);
+	lost("X"_dl) << nd("X"_dl),!canMove("X"_dl);
+	winning("X"_dl) << mv("X"_dl,"Y"_dl),lost("Y"_dl);
+	open("X"_dl) << nd("X"_dl),!winning("X"_dl),!lost("X"_dl);
+	reach("X"_dl,"Y"_dl) << mv("X"_dl,"Y"_dl),open("Y"_dl);
+	reach("X"_dl,"Y"_dl) << reach("X"_dl,"Z"_dl),mv("Z"_dl,"Y"_dl),open("Y"_dl);
+	reachLost("X"_dl) << reach("X"_dl,"Y"_dl),lost("Y"_dl);
+	doomed("X"_dl) << open("X"_dl),!reachLost("X"_dl);
+
+	for(parse *p: {&canMove,&lost,&winning,&open,&reach,&reachLost,&doomed})
+		add(w,*p);
+	w.query = "doomed";
+}
+
+void run(const std::string &name, void (*gen)(workload &, unsigned int, std::mt19937 &), unsigned int size, const eval_options &base)
+{
+	workload w;
+	std::mt19937 rng(42);
+	phases ph;
+	eval_options opts(base);
+	size_t input = 0;
+
+	w.name = name;
+	opts.trace = &ph;
+
+	auto t0 = std::chrono::steady_clock::now();
+	gen(w,size,rng);
+	auto t1 = std::chrono::steady_clock::now();
+	rel_ptr res = eval(w.query,w.idb,w.edb,opts);
+	auto t2 = std::chrono::steady_clock::now();
+
+	for(const std::pair<const std::string,rel_ptr> &p: w.edb)
+		input += p.second->rows().size();
+
+	const double gen_s = std::chrono::duration<double>(t1 - t0).count(), eval_s = std::chrono::duration<double>(t2 - t1).count();
+	const size_t output = res ? res->rows().size() : 0;
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF,&ru);
+
+	std::cout << std::fixed << std::setprecision(3)
+						<< name << ": " << input << " input, " << output << " " << w.query << " tuples, "
+						<< "generate " << gen_s << "s, eval " << eval_s << "s, "
+						<< std::setprecision(0) << (eval_s > 0 ? output / eval_s : 0) << " tuples/s, "
+						<< "peak rss " << ru.ru_maxrss / 1024 << " MiB" << std::endl;
+
+	unsigned int i = 0;
+	while(i < ph.m_seconds.size())
+	{
+		std::cout << std::setprecision(3) << "  stratum {" << ph.m_names[i] << "}: " << ph.m_seconds[i] << "s" << std::endl;
+		++i;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	const std::string which = argc > 1 ? argv[1] : "all";
+	const unsigned int size = argc > 2 ? std::strtoul(argv[2],0,10) : 1000;
+	eval_options opts;
+	bool found = false;
+
+	if(argc > 3)
+		opts.threads = std::strtoul(argv[3],0,10);
+	if(argc > 4)
+		opts.join = std::string(argv[4]) == "leapfrog" ? rule::Leapfrog : rule::Pairwise;
+
+	const std::list<std::pair<std::string,void (*)(workload &, unsigned int, std::mt19937 &)>> workloads({
+		std::make_pair("tc-chain",&tc_chain),
+		std::make_pair("tc-random",&tc_random),
+		std::make_pair("same-generation",&same_generation),
+		std::make_pair("andersen",&andersen),
+		std::make_pair("game",&game)
+	});
+
+	for(const std::pair<std::string,void (*)(workload &, unsigned int, std::mt19937 &)> &w: workloads)
+	{
+		if(which == "all" || which == w.first)
+		{
+			run(w.first,w.second,size,opts);
+			found = true;
+		}
+	}
+
+	if(!found)
+	{
+		std::cerr << "usage: " << argv[0] << " [all|tc-chain|tc-random|same-generation|andersen|game] [size] [threads] [pairwise|leapfrog]" << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
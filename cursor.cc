@@ -0,0 +1,62 @@
+#include "cursor.hh"
+
+cursor::cursor(rel_ptr rel, size_t limit)
+: m_relation(rel), m_end(0), m_pos(0)
+{
+	if(rel)
+		m_end = limit ? std::min(limit,rel->rows().size()) : rel->rows().size();
+}
+
+bool cursor::next(std::vector<relation::row_view> &batch, size_t n)
+{
+	batch.clear();
+
+	while(m_pos < m_end && batch.size() < n)
+		batch.push_back(m_relation->rows()[m_pos++]);
+
+	return !batch.empty();
+}
+
+size_t cursor::position(void) const
+{
+	return m_pos;
+}
+
+variant cursor::get(const relation::row_view &r, unsigned int col)
+{
+	return decode(r[col]);
+}
+
+size_t stream(const std::string &query, std::multimap<std::string,rule_ptr> &idb, std::map<std::string,rel_ptr> &edb, std::function<bool(const relation::row_view &)> f, size_t limit, const eval_options &opts)
+{
+	size_t ret = 0;
+	bool stopped = false;
+	auto pass = [&](const relation::row_view &r)
+	{
+		++ret;
+		stopped = !f(r) || ret == limit;
+		return !stopped;
+	};
+
+	rel_ptr res = eval(query,idb,edb,opts,[&](const std::string &pred, const relation &fresh)
+	{
+		if(pred == query)
+			for(const relation::row_view &r: fresh.rows())
+				if(!pass(r))
+					return false;
+		return true;
+	});
+
+	// w/o rules 'query' isn't derived by any stratum
+	if(res && !idb.count(query))
+		for(const relation::row_view &r: res->rows())
+			if(!pass(r))
+				break;
+
+	return ret;
+}
+
+bool exists(const std::string &query, std::multimap<std::string,rule_ptr> &idb, std::map<std::string,rel_ptr> &edb, const eval_options &opts)
+{
+	return stream(query,idb,edb,[](const relation::row_view &) { return false; },1,opts) > 0;
+}
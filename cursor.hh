@@ -0,0 +1,32 @@
+#ifndef CURSOR_HH
+#define CURSOR_HH
+
+#include "dlog.hh"
+
+// Batched iteration over a relation, optionally stopping after 'limit' rows. Values
+// stay encoded until read w/ get().
+class cursor
+{
+public:
+	cursor(rel_ptr rel, size_t limit = 0);
+
+	// replaces 'batch' w/ at most 'n' further rows, false once nothing is left
+	bool next(std::vector<relation::row_view> &batch, size_t n = 1024);
+	size_t position(void) const;
+
+	static variant get(const relation::row_view &r, unsigned int col);
+
+private:
+	rel_ptr m_relation;
+	size_t m_end, m_pos;
+};
+
+// Passes the tuples of 'query' to 'f' as soon as the stratum computing it derives them.
+// Evaluation stops after 'limit' tuples (0 for all) or once 'f' returns false. Returns
+// the number of tuples passed to 'f'.
+size_t stream(const std::string &query, std::multimap<std::string,rule_ptr> &idb, std::map<std::string,rel_ptr> &edb, std::function<bool(const relation::row_view &)> f, size_t limit = 0, const eval_options &opts = eval_options());
+
+// true if 'query' has at least one tuple, stops at the first one
+bool exists(const std::string &query, std::multimap<std::string,rule_ptr> &idb, std::map<std::string,rel_ptr> &edb, const eval_options &opts = eval_options());
+
+#endif
@@ -0,0 +1,460 @@
+#include "database.hh"
+#include "pool.hh"
+
+database::database(const std::multimap<std::string,rule_ptr> &idb, const std::map<std::string,rel_ptr> &edb, const eval_options &opts)
+: m_options(opts), m_pool(opts.threads > 1 ? new thread_pool(opts.threads) : 0)
+{
+	for(const std::pair<const std::string,rel_ptr> &p: edb)
+	{
+		rel_ptr r(new relation());
+
+		r->insert(p.second);
+		m_relations.insert(std::make_pair(p.first,r));
+	}
+
+	for(const std::pair<const std::string,rule_ptr> &p: idb)
+	{
+		if(!is_safe(p.second))
+		{
+			if(m_options.trace)
+				m_options.trace->unsafe(p.second);
+			continue;
+		}
+
+		m_idb.insert(p);
+	}
+
+	restratify();
+}
+
+database::~database(void)
+{
+	return;
+}
+
+rel_ptr database::query(const std::string &name)
+{
+	if(!m_pending.empty())
+		update();
+
+	// materialize the strata 'name' depends upon that aren't already
+	const std::set<std::string> needed = m_graph.depends(name);
+
+	for(const std::set<std::string> &s: m_strata)
+	{
+		if(m_materialized.count(*s.begin()) || !std::any_of(s.begin(),s.end(),[&](const std::string &n) { return needed.count(n); }))
+			continue;
+
+		for(const std::string &n: s)
+			m_relations.erase(n);
+
+		eval_stratum(s,m_idb,m_relations,m_options,m_pool.get());
+		m_materialized.insert(s.begin(),s.end());
+	}
+
+	return m_relations.count(name) ? m_relations[name] : rel_ptr(0);
+}
+
+bool database::insert(rule_ptr r)
+{
+	assert(r);
+
+	if(!is_safe(r))
+	{
+		if(m_options.trace)
+			m_options.trace->unsafe(r);
+		return false;
+	}
+
+	// facts of a predicate w/o rules would be lost
+	assert(m_idb.count(r->head.name) || !m_relations.count(r->head.name) || m_relations[r->head.name]->rows().empty());
+
+	m_idb.insert(std::make_pair(r->head.name,r));
+	invalidate(r->head.name);
+	m_relations.erase(r->head.name);
+	restratify();
+
+	return true;
+}
+
+bool database::retract(rule_ptr r)
+{
+	assert(r);
+
+	auto i = std::find_if(m_idb.lower_bound(r->head.name),m_idb.upper_bound(r->head.name),[&](const std::pair<const std::string,rule_ptr> &p) { return p.second == r; });
+
+	if(i == m_idb.upper_bound(r->head.name))
+		return false;
+
+	invalidate(r->head.name);
+	m_idb.erase(i);
+	restratify();
+
+	// w/o rules the predicate is empty
+	if(!m_idb.count(r->head.name))
+		m_relations[r->head.name] = rel_ptr(new relation());
+
+	return true;
+}
+
+void database::insert(const std::string &name, const relation::row &r)
+{
+	assert(!m_idb.count(name));
+	m_pending.push_back(std::make_pair(true,std::make_pair(name,r)));
+}
+
+void database::retract(const std::string &name, const relation::row &r)
+{
+	assert(!m_idb.count(name));
+	m_pending.push_back(std::make_pair(false,std::make_pair(name,r)));
+}
+
+void database::update(void)
+{
+	std::map<std::string,rel_ptr> plus, minus; // net changes per predicate
+	auto delta = [&](std::map<std::string,rel_ptr> &m, const std::string &n)
+	{
+		rel_ptr &r = m[n];
+
+		if(!r)
+			r = rel_ptr(new relation());
+		return r;
+	};
+
+	for(const std::pair<bool,std::pair<std::string,relation::row>> &c: m_pending)
+	{
+		const std::string &n = c.second.first;
+		const relation::row &r = c.second.second;
+		rel_ptr &rel = m_relations[n];
+
+		if(!rel)
+			rel = rel_ptr(new relation());
+
+		if(c.first && rel->insert(r) && !delta(minus,n)->remove(r))
+			delta(plus,n)->insert(r);
+		else if(!c.first && rel->remove(r) && !delta(plus,n)->remove(r))
+			delta(minus,n)->insert(r);
+	}
+	m_pending.clear();
+
+	for(const std::set<std::string> &s: m_strata)
+	{
+		// unmaterialized strata are computed from scratch when queried
+		if(!m_materialized.count(*s.begin()))
+			continue;
+
+		bool affected = std::any_of(s.begin(),s.end(),[&](const std::string &n)
+		{
+			return std::any_of(m_idb.lower_bound(n),m_idb.upper_bound(n),[&](const std::pair<const std::string,rule_ptr> &p)
+			{
+				return std::any_of(p.second->body.begin(),p.second->body.end(),[&](const predicate &q)
+					{ return (plus.count(q.name) && !plus[q.name]->rows().empty()) || (minus.count(q.name) && !minus[q.name]->rows().empty()); });
+			});
+		});
+
+		bool aggregated = std::any_of(s.begin(),s.end(),[&](const std::string &n)
+		{
+			return std::any_of(m_idb.lower_bound(n),m_idb.upper_bound(n),[&](const std::pair<const std::string,rule_ptr> &p)
+				{ return aggregate_column(p.second->head) < p.second->head.variables.size(); });
+		});
+
+		if(affected && aggregated)
+			recompute_stratum(s,plus,minus);
+		else if(affected)
+			update_stratum(s,plus,minus);
+	}
+}
+
+void database::invalidate(const std::string &name)
+{
+	std::set<std::string> drop;
+
+	for(const std::string &n: m_materialized)
+		if(m_graph.depends(n).count(name))
+			drop.insert(n);
+
+	for(const std::string &n: drop)
+	{
+		m_materialized.erase(n);
+		m_relations.erase(n);
+	}
+}
+
+void database::restratify(void)
+{
+	std::set<std::string> preds;
+
+	for(const std::pair<const std::string,rule_ptr> &p: m_idb)
+		preds.insert(p.first);
+
+	m_graph = dependency_graph(m_idb);
+	m_strata = m_graph.stratify(preds);
+}
+
+void database::update_stratum(const std::set<std::string> &stratum, std::map<std::string,rel_ptr> &plus, std::map<std::string,rel_ptr> &minus)
+{
+	std::vector<rule_ptr> rules, recursive, tasks;
+	std::vector<std::vector<rel_ptr>> plans;
+	std::map<std::string,rel_ptr> del, fresh, ins, deltas;
+	const rel_ptr none(new relation());
+	auto changed = [&](const std::map<std::string,rel_ptr> &m, const std::string &n)
+	{
+		auto i = m.find(n);
+		return !stratum.count(n) && i != m.end() && !i->second->rows().empty();
+	};
+
+	for(const std::string &s: stratum)
+	{
+		std::for_each(m_idb.lower_bound(s),m_idb.upper_bound(s),[&](const std::pair<const std::string,rule_ptr> &p)
+		{
+			rules.push_back(p.second);
+			if(is_recursive(p.second,stratum))
+				recursive.push_back(p.second);
+		});
+
+		del.insert(std::make_pair(s,rel_ptr(new relation())));
+		fresh.insert(std::make_pair(s,rel_ptr(new relation())));
+		ins.insert(std::make_pair(s,rel_ptr(new relation())));
+	}
+
+	// evaluates the queued rule variants and adds the result tuples passing 'keep' to 'out'
+	auto flush = [&](std::map<std::string,rel_ptr> &out, std::function<bool(const std::string &, const relation::row_view &)> keep)
+	{
+		std::vector<rel_ptr> results;
+
+		eval_rules(tasks,plans,results,m_options,m_pool.get());
+		for(unsigned int t = 0; t < tasks.size(); ++t)
+			if(results[t])
+				for(const relation::row_view &row: results[t]->rows())
+					if(keep(tasks[t]->head.name,row))
+						out[tasks[t]->head.name]->insert(row);
+
+		tasks.clear();
+		plans.clear();
+	};
+
+	// contents of a lower predicate before this update, built once: current \ plus + minus
+	std::map<std::string,rel_ptr> old;
+	auto before = [&](const std::string &n) -> rel_ptr
+	{
+		if(!changed(minus,n) && !changed(plus,n))
+			return m_relations[n];
+
+		rel_ptr &ret = old[n];
+
+		if(!ret)
+		{
+			ret = rel_ptr(new relation());
+			ret->insert(m_relations[n]);
+			if(changed(plus,n))
+				for(const relation::row_view &row: plus[n]->rows())
+					ret->remove(row);
+			if(changed(minus,n))
+				ret->insert(minus[n]);
+		}
+
+		return ret;
+	};
+
+	// 'r' w/ its i-th atom made positive
+	auto positive = [](rule_ptr r, unsigned int i)
+	{
+		rule_ptr ret(new rule(*r));
+
+		std::next(ret->body.begin(),i)->negated = false;
+		return ret;
+	};
+
+	if(m_options.trace)
+		m_options.trace->stratum(stratum);
+
+	auto overdelete = [&](const std::string &h, const relation::row_view &row) { return m_relations[h]->includes(row) && !del[h]->includes(row); };
+	auto missing = [&](const std::string &h, const relation::row_view &row) { return !m_relations[h]->includes(row); };
+
+	// 1. over-delete: every tuple w/ a derivation using a removed tuple in a positive atom or
+	// an inserted one in a negated atom. the relations of this stratum are still unchanged.
+	// one variant per changed atom: the atoms before it read the current relations, the ones
+	// after it those before the update. negated atoms are dropped, over-deleting is repaired
+	// in step 3.
+	for(rule_ptr r: rules)
+	{
+		unsigned int i = 0;
+
+		for(const predicate &p: r->body)
+		{
+			if(changed(p.negated ? plus : minus,p.name))
+			{
+				std::vector<rel_ptr> plan;
+				unsigned int j = 0;
+
+				for(const predicate &q: r->body)
+				{
+					if(j == i)
+						plan.push_back(p.negated ? plus[p.name] : minus[p.name]);
+					else if(q.negated)
+						plan.push_back(none);
+					else
+						plan.push_back(j > i ? before(q.name) : m_relations[q.name]);
+					++j;
+				}
+
+				tasks.push_back(p.negated ? positive(r,i) : r);
+				plans.push_back(plan);
+			}
+			++i;
+		}
+	}
+	flush(fresh,overdelete);
+
+	while(std::any_of(fresh.begin(),fresh.end(),[](const std::pair<const std::string,rel_ptr> &p) { return !p.second->rows().empty(); }))
+	{
+		std::map<std::string,rel_ptr> last;
+
+		for(const std::string &s: stratum)
+		{
+			del[s]->insert(fresh[s]);
+			last[s] = fresh[s];
+			fresh[s] = rel_ptr(new relation());
+		}
+
+		for(rule_ptr r: recursive)
+		{
+			unsigned int i = 0;
+
+			for(const predicate &p: r->body)
+			{
+				if(!p.negated && stratum.count(p.name) && !last[p.name]->rows().empty())
+				{
+					std::vector<rel_ptr> plan;
+					unsigned int j = 0;
+
+					for(const predicate &q: r->body)
+					{
+						if(j == i)
+							plan.push_back(last[p.name]);
+						else if(q.negated)
+							plan.push_back(none);
+						else
+							plan.push_back(before(q.name));
+						++j;
+					}
+
+					tasks.push_back(r);
+					plans.push_back(plan);
+				}
+				++i;
+			}
+		}
+		flush(fresh,overdelete);
+	}
+
+	// 2. remove
+	for(const std::string &s: stratum)
+		for(const relation::row_view &row: del[s]->rows())
+			m_relations[s]->remove(row);
+
+	// 3. rederive over-deleted tuples that still have a derivation. the rule body is
+	// prefixed w/ an atom over the deleted head tuples so only those are considered.
+	for(rule_ptr r: rules)
+	{
+		if(del[r->head.name]->rows().empty())
+			continue;
+
+		rule_ptr rd(new rule(*r));
+		std::vector<rel_ptr> plan({del[r->head.name]});
+
+		rd->body.push_front(predicate("@deleted",r->head.variables,false));
+		for(const predicate &p: r->body)
+			plan.push_back(m_relations[p.name]);
+
+		tasks.push_back(rd);
+		plans.push_back(plan);
+	}
+	flush(ins,missing);
+
+	// 4. insert tuples derived from inserted tuples in positive atoms or removed ones in
+	// negated atoms, then propagate them and the rederived ones through the stratum
+	for(rule_ptr r: rules)
+	{
+		unsigned int i = 0;
+
+		for(const predicate &p: r->body)
+		{
+			if(changed(p.negated ? minus : plus,p.name))
+			{
+				std::vector<rel_ptr> plan;
+				unsigned int j = 0;
+
+				for(const predicate &q: r->body)
+					plan.push_back(j++ == i ? (p.negated ? minus[p.name] : plus[p.name]) : m_relations[q.name]);
+
+				tasks.push_back(p.negated ? positive(r,i) : r);
+				plans.push_back(plan);
+			}
+			++i;
+		}
+	}
+	flush(ins,missing);
+
+	std::map<std::string,rel_ptr> added;
+	for(const std::string &s: stratum)
+	{
+		m_relations[s]->insert(ins[s]);
+		deltas[s] = ins[s];
+		added[s] = rel_ptr(new relation());
+		added[s]->insert(ins[s]);
+	}
+
+	fixpoint(stratum,recursive,m_relations,deltas,0,&added,m_options,m_pool.get());
+
+	if(m_options.trace)
+		m_options.trace->stratum_finish(stratum);
+
+	// net changes of this stratum for the ones above
+	for(const std::string &s: stratum)
+	{
+		rel_ptr p(new relation()), m(new relation());
+
+		for(const relation::row_view &row: del[s]->rows())
+			if(!m_relations[s]->includes(row))
+				m->insert(row);
+
+		for(const relation::row_view &row: added[s]->rows())
+			if(!del[s]->includes(row))
+				p->insert(row);
+
+		plus[s] = p;
+		minus[s] = m;
+	}
+}
+
+void database::recompute_stratum(const std::set<std::string> &stratum, std::map<std::string,rel_ptr> &plus, std::map<std::string,rel_ptr> &minus)
+{
+	std::map<std::string,rel_ptr> before;
+
+	for(const std::string &s: stratum)
+	{
+		before[s] = m_relations[s];
+		m_relations.erase(s);
+	}
+
+	eval_stratum(stratum,m_idb,m_relations,m_options,m_pool.get());
+
+	// net changes of this stratum for the ones above
+	for(const std::string &s: stratum)
+	{
+		rel_ptr p(new relation()), m(new relation());
+
+		for(const relation::row_view &row: m_relations[s]->rows())
+			if(!before[s] || !before[s]->includes(row))
+				p->insert(row);
+
+		if(before[s])
+			for(const relation::row_view &row: before[s]->rows())
+				if(!m_relations[s]->includes(row))
+					m->insert(row);
+
+		plus[s] = p;
+		minus[s] = m;
+	}
+}
@@ -0,0 +1,51 @@
+#ifndef DATABASE_HH
+#define DATABASE_HH
+
+#include <list>
+#include <memory>
+
+#include "dlog.hh"
+
+// Materialized program. Holds the extensional relations and every relation derived
+// from them by the rules. Derived relations (and their indices) are computed the first
+// time a query depends on them and kept until a rule change invalidates them. Changes
+// to extensional relations are buffered by insert() and retract() and propagated to the
+// derived relations by update(): insertions by semi-naive evaluation starting from the
+// new tuples, deletions by deleting every tuple w/ a derivation that used a removed
+// tuple and rederiving the ones that are still supported (DRed). Negated atoms turn
+// insertions into deletions and vice versa. Strata w/ aggregates are recomputed and
+// compared to their previous contents instead.
+class database
+{
+public:
+	database(const std::multimap<std::string,rule_ptr> &idb, const std::map<std::string,rel_ptr> &edb, const eval_options &opts = eval_options());
+	~database(void);
+
+	rel_ptr query(const std::string &name);
+
+	// facts
+	void insert(const std::string &name, const relation::row &r);
+	void retract(const std::string &name, const relation::row &r);
+	void update(void);
+
+	// rules. drop every derived relation depending on the head predicate
+	bool insert(rule_ptr r);
+	bool retract(rule_ptr r);
+
+private:
+	std::multimap<std::string,rule_ptr> m_idb;
+	std::map<std::string,rel_ptr> m_relations;
+	dependency_graph m_graph;
+	std::list<std::set<std::string>> m_strata;
+	std::set<std::string> m_materialized;
+	eval_options m_options;
+	std::unique_ptr<thread_pool> m_pool;
+	std::list<std::pair<bool,std::pair<std::string,relation::row>>> m_pending; // insert?, predicate, tuple
+
+	void invalidate(const std::string &name);
+	void restratify(void);
+	void update_stratum(const std::set<std::string> &stratum, std::map<std::string,rel_ptr> &plus, std::map<std::string,rel_ptr> &minus);
+	void recompute_stratum(const std::set<std::string> &stratum, std::map<std::string,rel_ptr> &plus, std::map<std::string,rel_ptr> &minus);
+};
+
+#endif
@@ -1,8 +1,24 @@
 #include <iostream>
+#include <iomanip>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
 
 #include "dlog.hh"
 #include "dsl.hh"
+#include "pool.hh"
+
+// profiling counters of the eval_rule() call running on this thread. only set w/ a tracer.
+// workers of partitioned joins share the counters of the calling thread.
+struct counters
+{
+	counters(void) : probes(0), peak(0) {}
+
+	std::atomic<size_t> probes, peak;
+};
+
+static thread_local counters *current_counters = 0;
 /*
 bool operator<(const variant &a, const variant &b)
 {
@@ -36,828 +52,2790 @@ bool operator>=(const variant &a, const variant &b)
 	return a == b || a > b;
 }
 
-const std::vector<relation::row> &relation::rows(void) const
+// chunk and offset of the i-th symbol
+static std::pair<unsigned int,size_t> slot(size_t i)
 {
-	return m_rows;
-}
+	size_t j = (i >> 6) + 1;
+	unsigned int k = 0;
 
-std::set<unsigned int> *relation::find(const std::vector<variable> &b) const
-{
-	if(m_rows.empty()) return 0;
-	assert(b.size() == m_rows[0].size());
+	while(j >>= 1)
+		++k;
 
-	if(m_indices.empty()) index();
-	assert(b.size() == m_indices.size());
-	
-	unsigned int col = 0;
-	std::set<unsigned int> *ret = 0;
-	std::multimap<std::string,unsigned int> unbound;
-	bool all = true;
-	bool last_pass = false;
+	return std::make_pair(k,i - ((size_t(1) << k) - 1) * 64);
+}
 
-	while(col < b.size())
-	{
-		const variable &var = b[col];
-		const std::unordered_multimap<variant,unsigned int> &idx = m_indices[col];
+symbol_table::symbol_table(void)
+: m_size(0)
+{
+	return;
+}
 
-		if(var.bound)
-		{
-			auto n = idx.equal_range(var.instantiation);
+value symbol_table::intern(const variant &v)
+{
+	std::lock_guard<std::mutex> guard(m_lock);
+	auto i = m_ids.find(v);
 
-			if(!ret)
-			{
-				ret = new std::set<unsigned int>();
-				while(n.first != n.second)
-					ret->insert((n.first++)->second);
-			}
-			else
-			{
-				std::set<unsigned int> eqr;
-				std::set<unsigned int> *nret = new std::set<unsigned int>();
+	if(i != m_ids.end())
+		return i->second;
 
-				while(n.first != n.second)
-					eqr.insert((n.first++)->second);
+	const size_t n = m_size.load(std::memory_order_relaxed);
+	const std::pair<unsigned int,size_t> s = slot(n);
+	value ret = n | 0x80000000;
 
-				std::set_intersection(eqr.begin(),eqr.end(),ret->begin(),ret->end(),std::inserter(*nret,nret->begin()));
-				delete ret;
-				ret = nret;
-			}
+	assert(!(n & 0x80000000));
+	if(!m_chunks[s.first])
+		m_chunks[s.first].reset(new variant[size_t(64) << s.first]);
+	m_chunks[s.first][s.second] = v;
+	m_size.store(n + 1,std::memory_order_release);
+	m_ids.insert(std::make_pair(v,ret));
 
-			all = false;
-		}
-		else
-		{
-			last_pass |= unbound.count(var.name) > 0;
-			unbound.insert(std::make_pair(var.name,col));
-		}
+	return ret;
+}
 
-		++col;
-	}
+const variant &symbol_table::at(value v) const
+{
+	assert(v & 0x80000000);
+	assert((v & 0x7fffffff) < m_size.load(std::memory_order_acquire));
 
-	if(all)
-	{
-		unsigned int i = 0;
+	const std::pair<unsigned int,size_t> s = slot(v & 0x7fffffff);
+	return m_chunks[s.first][s.second];
+}
 
-		ret = new std::set<unsigned int>();
-		while(i < m_rows.size())
-			ret->insert(i++);
-	}
+variant symbol_table::lookup(value v) const
+{
+	return at(v);
+}
 
-	assert(ret);
+bool symbol_table::less(value a, value b) const
+{
+	return at(a) < at(b);
+}
 
-	if(last_pass && unbound.size() > 1)
-	{
-		auto i = ret->begin();
-		while(i != ret->end())
-		{
-			const row &r = m_rows[*i];
-			auto j = unbound.begin();
+size_t symbol_table::size(void) const
+{
+	return m_size.load(std::memory_order_acquire);
+}
 
-			while(std::next(j) != unbound.end())
-			{
-				auto n = std::next(j);
+symbol_table &symbols(void)
+{
+	static symbol_table tbl;
+	return tbl;
+}
 
-				if(n->first == j->first)
-				{
-					if(!(r[n->second] == r[j->second]))
-					{
-						i = ret->erase(i);
-						break;
-					}
-				}
-				++j;
-			}
+value encode(const variant &v)
+{
+	if(v.type() == typeid(unsigned int) && !(boost::get<unsigned int>(v) & 0x80000000))
+		return boost::get<unsigned int>(v);
+	else
+		return symbols().intern(v);
+}
 
-			++i;
-		}
-	}
-						
-	return ret;
+variant decode(value v)
+{
+	if(v & 0x80000000)
+		return symbols().lookup(v);
+	else
+		return variant(v);
 }
-bool relation::includes(const relation::row &r) const
+
+bool value_less(value a, value b)
 {
-	std::vector<variable> b;
-	std::set<unsigned int> *coll;
-	bool ret = false;
-	
-	if(m_rows.empty() || r.size() != m_rows[0].size())
-		return ret;
+	// interned numbers are >= 2^31, so any small number orders first
+	if(!(a & b & 0x80000000))
+		return (a & 0x80000000) ? false : (b & 0x80000000) || a < b;
+	else if(a == b)
+		return false;
+	else
+		return symbols().less(a,b);
+}
 
-	for(const variant &v: r)
-		b.push_back(variable(true,v,""));
-	
-	coll = find(b);
+interval::interval(void)
+: has_lo(false), lo_strict(false), has_hi(false), hi_strict(false), lo(0), hi(0)
+{
+	return;
+}
 
-	if(coll)
+void interval::lower(value v, bool strict)
+{
+	if(!has_lo || value_less(lo,v) || (v == lo && strict))
 	{
-		ret = !coll->empty();
-		delete coll;
+		has_lo = true;
+		lo = v;
+		lo_strict = strict;
 	}
-
-	return ret;
 }
 
-bool relation::insert(const relation::row &r)
+void interval::upper(value v, bool strict)
 {
-	assert(m_rows.empty() || r.size() == m_rows[0].size());
-
-	if(!includes(r))
+	if(!has_hi || value_less(v,hi) || (v == hi && strict))
 	{
-		m_rows.push_back(r);
-		unsigned int j = 0;
-
-		while(j < r.size())
-		{
-			while(m_indices.size() <= j)
-				m_indices.push_back(std::unordered_multimap<variant,unsigned int>());
-			m_indices[j].insert(std::make_pair(r[j],m_rows.size() - 1));
-
-			++j;
-		}
-		return true;
+		has_hi = true;
+		hi = v;
+		hi_strict = strict;
 	}
-	else
-		return false;
 }
 
-bool relation::insert(rel_ptr r)
+bool interval::contains(value v) const
 {
-	assert(r);
-	bool ret = false;
-
-	for(const relation::row &s: r->rows())
-		ret |= insert(s);
-	
-	return ret;
+	return (!has_lo || (lo_strict ? value_less(lo,v) : !value_less(v,lo))) &&
+				 (!has_hi || (hi_strict ? value_less(v,hi) : !value_less(hi,v)));
 }
 
-void relation::reject(std::function<bool(const relation::row &)> f)
+relation::row_view::row_view(const relation *r, unsigned int i)
+: rel(r), index(i)
 {
-	auto i = m_rows.begin();
-	std::vector<row> n;
-	
-	n.reserve(m_rows.size());
-	while(i != m_rows.end())
-	{
-		if(f(*i))
-			m_indices.clear();
-		else
-			n.push_back(*i);
-		++i;
-	}
+	return;
+}
 
-	m_rows = n;
+value relation::row_view::operator[](unsigned int col) const
+{
+	return rel->m_data[col][index];
 }
 
-void relation::index(void) const
+value relation::row_view::at(unsigned int col) const
 {
-	m_indices.clear();
+	assert(col < rel->m_arity && index < rel->m_size);
+	return rel->m_data[col][index];
+}
 
-	auto i = m_rows.cbegin();
-	while(i != m_rows.cend())
-	{
-		const row &r = *i;
-		unsigned int j = 0;
+size_t relation::row_view::size(void) const
+{
+	return rel->m_arity;
+}
 
-		while(j < r.size())
-		{
-			while(m_indices.size() <= j)
-				m_indices.push_back(std::unordered_multimap<variant,unsigned int>());
-			m_indices[j].insert(std::make_pair(r[j],std::distance(m_rows.begin(),i)));
+relation::row_view::operator relation::row(void) const
+{
+	row ret;
+	unsigned int col = 0;
 
-			++j;
-		}
+	ret.reserve(size());
+	while(col < size())
+		ret.push_back(rel->m_data[col++][index]);
 
-		++i;
-	}
+	return ret;
 }
 
-variable::variable(bool b, variant v, std::string n)
-: bound(b), instantiation(v), name(n)
+relation::iterator::iterator(const relation *r, unsigned int i)
+: m_cur(r,i)
 {
 	return;
 }
 
-bool operator==(const variable &a, const variable &b)
+const relation::row_view &relation::iterator::operator*(void) const
 {
-	return a.bound == b.bound && 
-				((a.bound && a.instantiation == b.instantiation) ||
-				(!a.bound && a.name == b.name));
+	return m_cur;
 }
 
-std::ostream &operator<<(std::ostream &os, const variable &v)
-{	
-	if(v.bound)
-		os << v.instantiation;
-	else
-		os << v.name;
-	return os;
+const relation::row_view *relation::iterator::operator->(void) const
+{
+	return &m_cur;
 }
 
-variable symbolic(std::string n)
+relation::iterator &relation::iterator::operator++(void)
 {
-	return variable(false,false,n);
+	++m_cur.index;
+	return *this;
 }
 
-predicate::predicate(std::string n, std::initializer_list<variable> &lst, bool m)
-: name(n), variables(lst), negated(m)
+relation::iterator relation::iterator::operator++(int)
 {
-	return;
-} 
+	iterator ret(*this);
+	++m_cur.index;
+	return ret;
+}
 
-predicate::predicate(std::string n, const std::vector<variable> &lst, bool m)
-: name(n), variables(lst), negated(m)
+bool relation::iterator::operator==(const relation::iterator &i) const
 {
-	return;
+	return m_cur.rel == i.m_cur.rel && m_cur.index == i.m_cur.index;
 }
 
-bool operator==(const predicate &a, const predicate &b)
+bool relation::iterator::operator!=(const relation::iterator &i) const
 {
-	return a.name == b.name && a.variables == b.variables;
+	return !(*this == i);
 }
 
-std::ostream &operator<<(std::ostream &os, const predicate &p)
+relation::row_range::row_range(const relation *r)
+: m_relation(r)
 {
-	os << (p.negated ? "!" : "") << p.name << "(";
-	
-	for(const variable &v: p.variables)
-		if(v == *std::prev(p.variables.end(),1))
-			os << v;
-		else
-			os << v << ",";
-	
-	os << ")";
-	return os;
+	return;
 }
 
+relation::iterator relation::row_range::begin(void) const
+{
+	return iterator(m_relation,0);
+}
 
-constraint::constraint(Type t, variable a, variable b)
-: type(t), operand1(a), operand2(b)
+relation::iterator relation::row_range::end(void) const
 {
-	return;
+	return iterator(m_relation,m_relation->m_size);
 }
 
-bool constraint::operator()(const std::unordered_map<std::string,unsigned int> &binding, const relation::row &r) const 
+size_t relation::row_range::size(void) const
 {
-	variant a = !operand1.bound ? r.at(binding.at(operand1.name)) : operand1.instantiation,
-					b = !operand2.bound ? r.at(binding.at(operand2.name)) : operand2.instantiation;
-	
-	switch(type)
-	{
-		case Less: return a < b;
-		case LessOrEqual: return a <= b;
-		case Greater: return a > b;
-		case GreaterOrEqual: return a >= b;
-		default: assert(false);
-	}
+	return m_relation->m_size;
 }
 
-std::ostream &operator<<(std::ostream &os, const constraint &c)
+bool relation::row_range::empty(void) const
 {
-	os << c.operand1;
-	switch(c.type)
-	{
-		case constraint::Less: os << " > "; break;
-		case constraint::LessOrEqual: os << " >= "; break;
-		case constraint::Greater: os << " < "; break;
-		case constraint::GreaterOrEqual: os << " <= "; break;
-		default: assert(false);
-	}
-	os << c.operand2;
+	return m_relation->m_size == 0;
+}
 
-	return os;
+relation::row_view relation::row_range::operator[](unsigned int i) const
+{
+	assert(i < m_relation->m_size);
+	return row_view(m_relation,i);
 }
 
-rule::rule(predicate h)
-: head(h)
+relation::relation(void)
+: m_fixed(false), m_arity(0), m_size(0), m_hashed(true)
 {
 	return;
 }
 
-rule::rule(predicate h, std::initializer_list<predicate> &lst)
-: head(h), body(lst) 
+relation::relation(unsigned int a)
+: m_fixed(false), m_arity(0), m_size(0), m_hashed(true)
 {
-	return;
-} 
+	fix_arity(a);
+}
 
-rule::rule(predicate h, const std::list<predicate> &lst)
-: head(h) 
+relation::relation(unsigned int a, size_t rows, const std::vector<const value *> &cols, std::shared_ptr<const void> owner)
+: m_fixed(true), m_arity(a), m_size(rows), m_data(cols), m_external(owner), m_hashed(false)
 {
-	std::copy(lst.begin(),lst.end(),std::inserter(body,body.begin())); 
+	assert(a <= 64 && cols.size() == a && owner);
 }
 
-std::ostream &operator<<(std::ostream &os, const rule &r)
+relation::row_range relation::rows(void) const
 {
-	os << r.head;
-	
-	if(r.body.size() || r.constraints.size())
-	{
-		os << " :- ";
-		for(const predicate &p: r.body)
-			if(p == *std::prev(r.body.end(),1))
-				os << p;
-			else
-				os << p << ",";
-				
-		for(const constraint &c: r.constraints)
-			os << "," <<  c;
-	}
+	return row_range(this);
+}
 
-	return os;
+unsigned int relation::arity(void) const
+{
+	return m_arity;
 }
 
-std::ostream &operator<<(std::ostream &os, const relation &a)
+// number of distinct values in the columns set in 'mask'. the number of keys of the
+// composite index if it's already built, otherwise estimated from an evenly spaced
+// sample of rows (GEE: keys seen once scale w/ sqrt(rows/sample)). never builds an index.
+size_t relation::distinct(unsigned long long mask) const
 {
-	if(a.rows().empty())
+	if(!m_size)
+		return 0;
+	else if(!mask)
+		return 1;
+
 	{
-		os << "empty" << std::endl;
-		return os;
+		std::lock_guard<std::mutex> guard(m_index_lock);
+		auto i = m_indices.find(mask);
+
+		if(i != m_indices.end())
+			return i->second.size();
 	}
 
-	const size_t cols = a.rows().begin()->size();
-	size_t *widths = new size_t[cols];
-	std::list<std::list<std::string>> text;
-	size_t col = 0;
+	const size_t sample = std::min<size_t>(m_size,512);
+	std::unordered_map<size_t,unsigned int> seen;
+	size_t once = 0;
 
-	while(col < cols)
-	{
-		widths[col] = 0;
-	 	++col;
-	}
+	for(size_t s = 0; s < sample; ++s)
+		++seen[hash_key(row_view(this,s * m_size / sample),mask)];
+	for(const std::pair<const size_t,unsigned int> &k: seen)
+		once += k.second == 1;
 
-	auto row = a.rows().begin();
-	while(row != a.rows().end())
+	return std::max<size_t>(1,std::min<size_t>(m_size,std::sqrt((double)m_size / sample) * once + (seen.size() - once)));
+}
+
+const value *relation::column(unsigned int col) const
+{
+	assert(col < m_arity);
+	return m_data[col];
+}
+
+std::vector<unsigned int> relation::find(const std::vector<variable> &b) const
+{
+	std::vector<unsigned int> ret;
+
+	find(b,ret);
+	return ret;
+}
+
+// fills 'ret' w/ the matching row numbers. callers probing repeatedly pass the same
+// vector to reuse its storage. works w/o heap allocations besides growing 'ret'.
+void relation::find(const std::vector<variable> &b, std::vector<unsigned int> &ret) const
+{
+	if(current_counters)
+		++current_counters->probes;
+
+	ret.clear();
+	if(!m_size) return;
+	assert(b.size() == m_arity && m_arity <= 64);
+
+	unsigned int col = 0;
+	std::array<value,64> key;
+	std::array<unsigned char,64> same; // first column bound to the same free variable
+	unsigned long long mask = 0;
+	bool repeated = false;
+
+	while(col < b.size())
 	{
-		col = 0;
-		
-		text.push_back(std::list<std::string>());
+		const variable &var = b[col];
 
-		while(col < cols)
+		same[col] = col;
+		if(var.bound)
 		{
-			std::stringstream ss;
+			mask |= 1ull << col;
+			key[col] = var.instantiation;
+		}
+		else
+		{
+			unsigned int prev = 0;
 
-			ss << std::boolalpha << row->at(col);
-			text.back().push_back(ss.str());
-			widths[col] = std::max(ss.str().size(),widths[col]);
-	 		++col;
+			while(prev < col && (b[prev].bound || b[prev].name != var.name))
+				++prev;
+			same[col] = prev;
+			repeated |= prev < col;
 		}
 
-		++row;
+		++col;
 	}
 
-	std::function<void(void)> do_line = [&](void)
+	if(mask)
 	{
-		os << std::setfill('-');
-		col = 0;
-		while(col < cols)
-			os << "+-" << std::setw(widths[col++]) << "-" << "-";
-		os << "+" << std::endl << std::setfill(' ');
-	};
+		// one probe into the index over exactly the bound columns
+		const index &idx = index_for(mask);
+		auto n = idx.find(hash_key(key,mask));
+
+		if(n != idx.end())
+			for(unsigned int i: n->second)
+				if(matches(i,key,mask))
+					ret.push_back(i);
+	}
+	else
+	{
+		unsigned int i = 0;
 
-	do_line();
+		ret.reserve(m_size);
+		while(i < m_size)
+			ret.push_back(i++);
+	}
 
-	// rows
-	for(const std::list<std::string> &r: text)
+	// drop rows that disagree in columns bound to the same free variable
+	if(repeated)
 	{
-		col = 0;
-		while(col < cols)
+		ret.erase(std::remove_if(ret.begin(),ret.end(),[&](unsigned int i)
 		{
-			os << "| " << std::setw(widths[col]); 
-			os << *std::next(r.begin(),col++) << " ";
+			for(col = 0; col < m_arity; ++col)
+				if(same[col] != col && m_data[col][i] != m_data[same[col]][i])
+					return true;
+			return false;
+		}),ret.end());
+	}
+}
+
+// finalizer of MurmurHash3. std::hash is the identity for integers, dense ids would
+// otherwise collide once combined.
+inline unsigned long long fmix64(unsigned long long k)
+{
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdull;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ull;
+	k ^= k >> 33;
+	return k;
+}
+
+template<typename R>
+size_t relation::hash_key(const R &r, unsigned long long mask) const
+{
+	unsigned long long ret = m_arity;
+	unsigned int col = 0;
+
+	while(col < m_arity)
+	{
+		if(mask & (1ull << col))
+			ret = fmix64(ret ^ (fmix64(r[col]) + 0x9e3779b97f4a7c15ull + (ret << 6) + (ret >> 2)));
+		++col;
+	}
+
+	return ret;
+}
+
+template<typename R>
+size_t relation::hash_row(const R &r) const
+{
+	return hash_key(r,~0ull);
+}
+
+template<typename R>
+bool relation::matches(unsigned int i, const R &r, unsigned long long mask) const
+{
+	unsigned int col = 0;
+
+	while(col < m_arity)
+	{
+		if((mask & (1ull << col)) && !(m_data[col][i] == r[col]))
+			return false;
+		++col;
+	}
+
+	return true;
+}
+
+template<typename R>
+bool relation::lookup(const R &r, size_t h) const
+{
+	hash_rows();
+	auto n = m_tuples.equal_range(h);
+
+	while(n.first != n.second)
+		if(matches((n.first++)->second,r,~0ull))
+			return true;
+
+	return false;
+}
+
+template<typename R>
+bool relation::append(const R &r)
+{
+	fix_arity(r.size());
+
+	size_t h = hash_row(r);
+	unsigned int col = 0;
+
+	if(lookup(r,h))
+		return false;
+
+	own();
+	while(col < m_arity)
+	{
+		m_columns[col].push_back(r[col]);
+		m_data[col] = m_columns[col].data();
+		++col;
+	}
+
+	for(std::pair<const unsigned long long,index> &p: m_indices)
+		p.second[hash_key(r,p.first)].push_back(m_size);
+
+	m_tuples.insert(std::make_pair(h,m_size));
+	++m_size;
+
+	return true;
+}
+
+// row adapter over a plain array of values
+struct span_row
+{
+	span_row(const value *p, unsigned int n) : ptr(p), len(n) {}
+
+	value operator[](unsigned int col) const { return ptr[col]; }
+	size_t size(void) const { return len; }
+
+	const value *ptr;
+	unsigned int len;
+};
+
+bool relation::includes(const value *r, unsigned int n) const
+{
+	const span_row s(r,n);
+	return n == m_arity && m_size && lookup(s,hash_row(s));
+}
+
+bool relation::insert(const value *r, unsigned int n)
+{
+	return append(span_row(r,n));
+}
+
+bool relation::includes(const relation::row &r) const
+{
+	return r.size() == m_arity && m_size && lookup(r,hash_row(r));
+}
+
+bool relation::includes(const relation::row_view &r) const
+{
+	return r.size() == m_arity && m_size && lookup(r,hash_row(r));
+}
+
+bool relation::insert(const relation::row &r)
+{
+	return append(r);
+}
+
+bool relation::insert(const relation::row_view &r)
+{
+	return append(r);
+}
+
+bool relation::insert(rel_ptr r)
+{
+	assert(r);
+	bool ret = false;
+
+	if(r.get() == this || r->rows().empty())
+		return false;
+
+	fix_arity(r->arity());
+	own();
+	hash_rows();
+
+	// size the columns and the tuple set for the whole batch once. capacity at least
+	// doubles so repeated merges (e.g. of deltas) stay amortized linear.
+	const size_t want = m_size + r->m_size;
+
+	if(m_columns.empty() || m_columns.front().capacity() < want)
+	{
+		for(std::vector<value> &c: m_columns)
+			c.reserve(std::max(want,2 * c.capacity()));
+		sync();
+	}
+	if(m_tuples.bucket_count() * m_tuples.max_load_factor() < want)
+		m_tuples.reserve(std::max(want,2 * m_tuples.size()));
+
+	for(const relation::row_view &s: r->rows())
+		ret |= append(s);
+	
+	return ret;
+}
+
+// removes 'r' by moving the last row into its place. indices are kept up to date.
+bool relation::remove(const relation::row &r)
+{
+	if(r.size() != m_arity || !m_size)
+		return false;
+
+	own();
+	hash_rows();
+	auto n = m_tuples.equal_range(hash_row(r));
+
+	while(n.first != n.second && !matches(n.first->second,r,~0ull))
+		++n.first;
+
+	if(n.first == n.second)
+		return false;
+
+	const unsigned int i = n.first->second, last = m_size - 1;
+	const row_view moved(this,last);
+
+	m_tuples.erase(n.first);
+
+	// drop 'i' from the ordered indices and rename 'last', which moves into its place
+	for(auto p = m_ordered.begin(); p != m_ordered.end();)
+	{
+		std::vector<unsigned int> &ord = p->second;
+		const value *c = m_data[p->first];
+		auto at = [&](unsigned int row)
+		{
+			auto e = std::equal_range(ord.begin(),ord.end(),row,[&](unsigned int a, unsigned int b) { return value_less(c[a],c[b]); });
+			return std::find(e.first,e.second,row);
+		};
+
+		// rows appended since the last merge aren't in 'ord' yet
+		if(ord.size() < m_size)
+		{
+			p = m_ordered.erase(p);
+			continue;
 		}
-		os << "| " << std::endl;
+
+		ord.erase(at(i));
+		if(i != last)
+			*at(last) = i;
+		++p;
+	}
+
+	for(std::pair<const unsigned long long,index> &p: m_indices)
+	{
+		auto b = p.second.find(hash_key(r,p.first));
+
+		assert(b != p.second.end());
+		b->second.erase(std::find(b->second.begin(),b->second.end(),i));
+		if(b->second.empty())
+			p.second.erase(b);
+
+		if(i != last)
+		{
+			std::vector<unsigned int> &l = p.second[hash_key(moved,p.first)];
+			*std::find(l.begin(),l.end(),last) = i;
+		}
+	}
+
+	if(i != last)
+	{
+		auto m = m_tuples.equal_range(hash_row(moved));
+
+		while(m.first->second != last)
+			++m.first;
+		m.first->second = i;
+
+		for(std::vector<value> &c: m_columns)
+			c[i] = c[last];
 	}
+
+	for(std::vector<value> &c: m_columns)
+		c.pop_back();
+	--m_size;
+	sync();
+
+	return true;
+}
+
+void relation::reject(std::function<bool(const relation::row_view &)> f)
+{
+	std::vector<std::vector<value>> n(m_arity);
+	unsigned int i = 0, kept = 0, col;
 	
-	do_line();
-	delete[] widths;
+	for(std::vector<value> &c: n)
+		c.reserve(m_size);
+
+	while(i < m_size)
+	{
+		if(!f(row_view(this,i)))
+		{
+			for(col = 0; col < m_arity; ++col)
+				n[col].push_back(m_data[col][i]);
+			++kept;
+		}
+		++i;
+	}
+
+	m_size = kept;
+	m_columns.swap(n);
+	m_external.reset();
+	m_indices.clear();
+	m_ordered.clear();
+	sync();
+
+	m_tuples.clear();
+	for(i = 0; i < m_size; ++i)
+		m_tuples.insert(std::make_pair(hash_row(row_view(this,i)),i));
+	m_hashed = true;
+}
+
+void relation::fix_arity(unsigned int a)
+{
+	if(m_fixed)
+	{
+		assert(a == m_arity);
+		return;
+	}
+
+	assert(a <= 64);
+	m_fixed = true;
+	m_arity = a;
+	m_columns.resize(a);
+	sync();
+}
+
+// copies external columns before the first modification
+void relation::own(void)
+{
+	if(!m_external)
+		return;
+
+	unsigned int col = 0;
+
+	m_columns.resize(m_arity);
+	while(col < m_arity)
+	{
+		m_columns[col].assign(m_data[col],m_data[col] + m_size);
+		++col;
+	}
+
+	m_external.reset();
+	sync();
+}
+
+void relation::sync(void)
+{
+	unsigned int col = 0;
+
+	m_data.resize(m_arity);
+	while(col < m_arity)
+	{
+		m_data[col] = m_columns[col].data();
+		++col;
+	}
+}
+
+// relations over external columns build the duplicate table on first use
+void relation::hash_rows(void) const
+{
+	if(m_hashed)
+		return;
+
+	std::lock_guard<std::mutex> guard(m_index_lock);
+
+	if(m_hashed)
+		return;
+
+	unsigned int i = 0;
+
+	m_tuples.reserve(m_size);
+	while(i < m_size)
+	{
+		m_tuples.insert(std::make_pair(hash_row(row_view(this,i)),i));
+		++i;
+	}
+
+	m_hashed = true;
+}
+
+const std::vector<unsigned int> &relation::ordered_for(unsigned int col) const
+{
+	std::lock_guard<std::mutex> guard(m_index_lock);
+	std::vector<unsigned int> &ord = m_ordered[col];
+	const value *c = m_data[col];
+	const size_t known = ord.size();
+	auto less = [&](unsigned int a, unsigned int b) { return value_less(c[a],c[b]); };
+
+	if(known == m_size)
+		return ord;
+
+	// rows are only ever appended between merges, sort the new ones and merge them in
+	assert(known < m_size);
+	ord.resize(m_size);
+	for(size_t r = known; r < m_size; ++r)
+		ord[r] = r;
+	std::sort(ord.begin() + known,ord.end(),less);
+	std::inplace_merge(ord.begin(),ord.begin() + known,ord.end(),less);
+
+	return ord;
+}
+
+// rows whose value in 'col' lies in 'iv', found by binary search in a sorted copy of the
+// column's row numbers. built on first use and kept up to date on later ones.
+void relation::range(unsigned int col, const interval &iv, std::vector<unsigned int> &ret) const
+{
+	if(current_counters)
+		++current_counters->probes;
+
+	ret.clear();
+	if(!m_size) return;
+	assert(col < m_arity);
+
+	const std::vector<unsigned int> &ord = ordered_for(col);
+	const value *c = m_data[col];
+	auto b = ord.begin(), e = ord.end();
+
+	if(iv.has_lo)
+		b = iv.lo_strict ? std::upper_bound(b,e,iv.lo,[&](value v, unsigned int r) { return value_less(v,c[r]); })
+										 : std::lower_bound(b,e,iv.lo,[&](unsigned int r, value v) { return value_less(c[r],v); });
+	if(iv.has_hi)
+		e = iv.hi_strict ? std::lower_bound(b,e,iv.hi,[&](unsigned int r, value v) { return value_less(c[r],v); })
+										 : std::upper_bound(b,e,iv.hi,[&](value v, unsigned int r) { return value_less(v,c[r]); });
+
+	if(b < e)
+		ret.assign(b,e);
+}
+
+void relation::build_index(unsigned long long mask) const
+{
+	index_for(mask);
+}
+
+std::set<unsigned long long> relation::indices(void) const
+{
+	std::lock_guard<std::mutex> guard(m_index_lock);
+	std::set<unsigned long long> ret;
+
+	for(const std::pair<const unsigned long long,index> &p: m_indices)
+		ret.insert(p.first);
+
+	return ret;
+}
+
+const relation::index &relation::index_for(unsigned long long mask) const
+{
+	// rules evaluated in parallel may build indices on a shared relation at the same time
+	std::lock_guard<std::mutex> guard(m_index_lock);
+	auto i = m_indices.find(mask);
 
+	if(i != m_indices.end())
+		return i->second;
+
+	index &idx = m_indices[mask];
+	unsigned int r = 0;
+
+	while(r < m_size)
+	{
+		idx[hash_key(row_view(this,r),mask)].push_back(r);
+		++r;
+	}
+
+	return idx;
+}
+
+variable::variable(bool b, variant v, std::string n, Aggregate a)
+: bound(b), instantiation(b ? encode(v) : 0), name(n), aggregate(a)
+{
+	return;
+}
+
+bool operator==(const variable &a, const variable &b)
+{
+	return a.bound == b.bound && 
+				((a.bound && a.instantiation == b.instantiation) ||
+				(!a.bound && a.name == b.name));
+}
+
+std::ostream &operator<<(std::ostream &os, const variable &v)
+{	
+	const char *agg[] = {"", "min", "max", "count", "sum"};
+
+	if(v.bound)
+		os << decode(v.instantiation);
+	else if(v.aggregate != variable::None)
+		os << agg[v.aggregate] << "(" << v.name << ")";
+	else
+		os << v.name;
 	return os;
 }
 
-/*
-variable find_helper(const ub &)
+variable symbolic(std::string n)
 {
-	return variable(false,"","X");
+	return variable(false,false,n);
+}
+
+predicate::predicate(std::string n, std::initializer_list<variable> &lst, bool m)
+: name(n), variables(lst), negated(m)
+{
+	return;
+} 
+
+predicate::predicate(std::string n, const std::vector<variable> &lst, bool m)
+: name(n), variables(lst), negated(m)
+{
+	return;
+}
+
+bool operator==(const predicate &a, const predicate &b)
+{
+	return a.name == b.name && a.variables == b.variables;
+}
+
+std::ostream &operator<<(std::ostream &os, const predicate &p)
+{
+	os << (p.negated ? "!" : "") << p.name << "(";
+	
+	for(const variable &v: p.variables)
+		if(v == *std::prev(p.variables.end(),1))
+			os << v;
+		else
+			os << v << ",";
+	
+	os << ")";
+	return os;
+}
+
+
+constraint::constraint(Type t, variable a, variable b)
+: type(t), operand1(a), operand2(b)
+{
+	return;
+}
+
+bool constraint::operator()(const std::unordered_map<std::string,unsigned int> &binding, const relation::row &r) const 
+{
+	return holds(type,!operand1.bound ? r.at(binding.at(operand1.name)) : operand1.instantiation,
+										!operand2.bound ? r.at(binding.at(operand2.name)) : operand2.instantiation);
+}
+
+bool constraint::operator()(const std::unordered_map<std::string,unsigned int> &binding, const relation::row_view &r) const 
+{
+	return holds(type,!operand1.bound ? r[binding.at(operand1.name)] : operand1.instantiation,
+										!operand2.bound ? r[binding.at(operand2.name)] : operand2.instantiation);
+}
+
+constraint::Type constraint::flip(Type t)
+{
+	switch(t)
+	{
+		case Less: return Greater;
+		case LessOrEqual: return GreaterOrEqual;
+		case Greater: return Less;
+		case GreaterOrEqual: return LessOrEqual;
+		default: assert(false); return t;
+	}
+}
+
+bool constraint::holds(Type t, value a, value b)
+{
+	switch(t)
+	{
+		case Less: return value_less(a,b);
+		case LessOrEqual: return !value_less(b,a);
+		case Greater: return value_less(b,a);
+		case GreaterOrEqual: return !value_less(a,b);
+		default: assert(false); return false;
+	}
+}
+
+std::ostream &operator<<(std::ostream &os, const constraint &c)
+{
+	os << c.operand1;
+	switch(c.type)
+	{
+		case constraint::Less: os << " > "; break;
+		case constraint::LessOrEqual: os << " >= "; break;
+		case constraint::Greater: os << " < "; break;
+		case constraint::GreaterOrEqual: os << " <= "; break;
+		default: assert(false);
+	}
+	os << c.operand2;
+
+	return os;
+}
+
+rule::rule(predicate h)
+: head(h), join(Default)
+{
+	return;
+}
+
+rule::rule(predicate h, std::initializer_list<predicate> &lst)
+: head(h), body(lst), join(Default)
+{
+	return;
+} 
+
+rule::rule(predicate h, const std::list<predicate> &lst)
+: head(h), join(Default)
+{
+	std::copy(lst.begin(),lst.end(),std::inserter(body,body.begin())); 
+}
+
+std::ostream &operator<<(std::ostream &os, const rule &r)
+{
+	os << r.head;
+	
+	if(r.body.size() || r.constraints.size())
+	{
+		os << " :- ";
+		for(const predicate &p: r.body)
+			if(p == *std::prev(r.body.end(),1))
+				os << p;
+			else
+				os << p << ",";
+				
+		for(const constraint &c: r.constraints)
+			os << "," <<  c;
+	}
+
+	return os;
+}
+
+std::ostream &operator<<(std::ostream &os, const relation &a)
+{
+	if(a.rows().empty())
+	{
+		os << "empty" << std::endl;
+		return os;
+	}
+
+	const size_t cols = a.arity();
+	size_t *widths = new size_t[cols];
+	std::list<std::list<std::string>> text;
+	size_t col = 0;
+
+	while(col < cols)
+	{
+		widths[col] = 0;
+	 	++col;
+	}
+
+	auto row = a.rows().begin();
+	while(row != a.rows().end())
+	{
+		col = 0;
+		
+		text.push_back(std::list<std::string>());
+
+		while(col < cols)
+		{
+			std::stringstream ss;
+
+			ss << std::boolalpha << decode(row->at(col));
+			text.back().push_back(ss.str());
+			widths[col] = std::max(ss.str().size(),widths[col]);
+	 		++col;
+		}
+
+		++row;
+	}
+
+	std::function<void(void)> do_line = [&](void)
+	{
+		os << std::setfill('-');
+		col = 0;
+		while(col < cols)
+			os << "+-" << std::setw(widths[col++]) << "-" << "-";
+		os << "+" << std::endl << std::setfill(' ');
+	};
+
+	do_line();
+
+	// rows
+	for(const std::list<std::string> &r: text)
+	{
+		col = 0;
+		while(col < cols)
+		{
+			os << "| " << std::setw(widths[col]); 
+			os << *std::next(r.begin(),col++) << " ";
+		}
+		os << "| " << std::endl;
+	}
+	
+	do_line();
+	delete[] widths;
+
+	return os;
+}
+
+/*
+variable find_helper(const ub &)
+{
+	return variable(false,"","X");
+}
+
+variable find_helper(variant v)
+{
+	return variable(true,v,"");
+}*/
+
+// constraints and negated atoms of a rule, checked on rows laid out like 'binding'. a
+// negated atom is an anti-join: its key is assembled from the row and looked up in
+// the tuple hash table of its relation, which is built once and shared by all rows.
+class row_filter
+{
+public:
+	row_filter(const rule_ptr r, const std::vector<variable> &binding, const std::vector<rel_ptr> &relations)
+	{
+		std::unordered_map<std::string,unsigned int> cols;
+		unsigned int pi = 0;
+
+		for(unsigned int c = 0; c < binding.size(); ++c)
+			if(!binding[c].bound)
+				cols.insert(std::make_pair(binding[c].name,c));
+
+		auto operand_for = [&](const variable &v) { return v.bound ? operand({true,v.instantiation,0}) : operand({false,0,cols.at(v.name)}); };
+
+		for(const constraint &c: r->constraints)
+			m_constraints.push_back(check({c.type,operand_for(c.operand1),operand_for(c.operand2)}));
+
+		for(const predicate &p: r->body)
+		{
+			const rel_ptr rel = relations[pi++];
+
+			// nothing to exclude
+			if(!p.negated || rel->rows().empty())
+				continue;
+
+			m_anti.push_back(anti());
+			assert(p.variables.size() <= 64);
+			m_anti.back().rel = rel;
+			for(const variable &v: p.variables)
+				m_anti.back().key.push_back(operand_for(v));
+		}
+	}
+
+	bool empty(void) const { return m_constraints.empty() && m_anti.empty(); }
+
+	bool operator()(const value *row) const
+	{
+		for(const check &c: m_constraints)
+			if(!constraint::holds(c.type,c.a(row),c.b(row)))
+				return false;
+
+		for(const anti &a: m_anti)
+		{
+			std::array<value,64> key;
+			unsigned int k = 0;
+
+			for(const operand &o: a.key)
+				key[k++] = o(row);
+
+			if(a.rel->includes(key.data(),k))
+				return false;
+		}
+
+		return true;
+	}
+
+private:
+	struct operand
+	{
+		bool constant;
+		value v;
+		unsigned int col;
+
+		value operator()(const value *row) const { return constant ? v : row[col]; }
+	};
+
+	struct check
+	{
+		constraint::Type type;
+		operand a, b;
+	};
+
+	struct anti
+	{
+		rel_ptr rel;
+		std::vector<operand> key;
+	};
+
+	std::vector<check> m_constraints;
+	std::vector<anti> m_anti;
+};
+
+// constant bounds on the columns of a body atom
+typedef std::vector<std::pair<unsigned int,interval>> column_bounds;
+
+// bounds the constraints of 'r' w/ a constant put on the variables of 'p'
+static column_bounds bounds_for(const rule_ptr r, const predicate &p)
+{
+	column_bounds ret;
+
+	for(const constraint &c: r->constraints)
+	{
+		if(c.operand1.bound == c.operand2.bound)
+			continue;
+
+		const variable &v = c.operand1.bound ? c.operand2 : c.operand1;
+		const value k = c.operand1.bound ? c.operand1.instantiation : c.operand2.instantiation;
+		const constraint::Type t = c.operand1.bound ? constraint::flip(c.type) : c.type; // v t k
+		unsigned int col = 0;
+
+		for(col = 0; col < p.variables.size(); ++col)
+		{
+			if(p.variables[col].bound || p.variables[col].name != v.name)
+				continue;
+
+			auto l = std::find_if(ret.begin(),ret.end(),[&](const std::pair<unsigned int,interval> &q) { return q.first == col; });
+			if(l == ret.end())
+				l = ret.insert(ret.end(),std::make_pair(col,interval()));
+
+			switch(t)
+			{
+				case constraint::Less: l->second.upper(k,true); break;
+				case constraint::LessOrEqual: l->second.upper(k,false); break;
+				case constraint::Greater: l->second.lower(k,true); break;
+				case constraint::GreaterOrEqual: l->second.lower(k,false); break;
+			}
+		}
+	}
+
+	return ret;
+}
+
+// rows of 'rel' matching 'vars' inside 'bounds'. w/o constants or repeated variables in
+// 'vars' the first bounded column is read w/ a range scan, other bounds are checked per row.
+static void matching(const rel_ptr rel, const std::vector<variable> &vars, const column_bounds &bounds, std::vector<unsigned int> &ret)
+{
+	bool scan = !bounds.empty();
+
+	for(unsigned int col = 0; scan && col < vars.size(); ++col)
+		scan = !vars[col].bound && std::count(vars.begin(),vars.end(),vars[col]) == 1;
+
+	if(scan)
+		rel->range(bounds.front().first,bounds.front().second,ret);
+	else
+		rel->find(vars,ret);
+
+	if(!bounds.empty())
+	{
+		ret.erase(std::remove_if(ret.begin(),ret.end(),[&](unsigned int i)
+		{
+			return std::any_of(bounds.begin() + (scan ? 1 : 0),bounds.end(),[&](const std::pair<unsigned int,interval> &l) { return !l.second.contains(rel->column(l.first)[i]); });
+		}),ret.end());
+	}
+}
+
+// comparison constraint between a column of the inner and one of the outer side of a join
+struct band
+{
+	unsigned int b_col;
+	constraint::Type type;	// b_col type a_col
+	unsigned int a_col;
+};
+
+// joins the rows of 'a_rel' matching 'a_bind' w/ those of 'b_rel' matching 'b_bind'. if
+// 'pool' is set and the outer side has at least 'partition' rows it is split across the
+// workers, each probing into its own output relation. the parts are merged afterwards.
+// inner rows must also satisfy 'bands' and 'b_bounds', outer ones 'a_bounds'. w/o shared
+// variables these are answered by range scans over the inner relation instead of
+// enumerating the cross product. joined rows 'keep' rejects are dropped before they're inserted.
+rel_ptr join(const std::vector<variable> &a_bind,const rel_ptr a_rel,const std::vector<variable> &b_bind,const rel_ptr b_rel, thread_pool *pool, size_t partition, const std::vector<band> &bands = std::vector<band>(), const column_bounds &a_bounds = column_bounds(), const column_bounds &b_bounds = column_bounds(), const row_filter *keep = 0)
+{
+	assert(a_rel && b_rel);
+	std::vector<unsigned int> outer;
+	std::multimap<unsigned int,unsigned int> cross_vars; // a -> b
+
+	matching(a_rel,a_bind,a_bounds,outer);
+	rel_ptr ret(new relation(a_bind.size() + b_bind.size()));
+
+	if(outer.empty())
+		return ret;
+
+	auto i = a_bind.begin();
+	while(i != a_bind.end())
+	{
+		if(!i->bound)
+		{
+			auto j = b_bind.begin();
+			while(j != b_bind.end())
+			{
+				if(!j->bound && i->name ==j->name)
+			 		cross_vars.insert(std::make_pair(std::distance(a_bind.begin(),i),std::distance(b_bind.begin(),j)));
+				++j;
+			}
+		}
+		++i;
+	}
+
+	// range scans need an inner side w/o constants or repeated variables
+	bool scan = cross_vars.empty() && (!bands.empty() || !b_bounds.empty());
+
+	for(unsigned int col = 0; scan && col < b_bind.size(); ++col)
+		scan = !b_bind[col].bound && std::count(b_bind.begin(),b_bind.end(),b_bind[col]) == 1;
+
+	// the matches and the output row are scratch buffers reused for every probe
+	auto probe = [&](size_t from, size_t to, rel_ptr out)
+	{
+		std::vector<variable> binding(b_bind);
+		std::vector<unsigned int> b_idx;
+		relation::row nr(a_bind.size() + b_bind.size());
+		column_bounds limits; // inner column -> allowed values
+
+		for(const std::pair<unsigned int,unsigned int> &xv: cross_vars)
+			binding[xv.second].bound = true;
+
+		while(from < to)
+		{	
+			const relation::row_view r = a_rel->rows()[outer[from++]];
+
+			for(const std::pair<unsigned int,unsigned int> &xv: cross_vars)
+				binding[xv.second].instantiation = r[xv.first];
+
+			limits.assign(b_bounds.begin(),b_bounds.end());
+			for(const band &bd: bands)
+			{
+				auto l = std::find_if(limits.begin(),limits.end(),[&](const std::pair<unsigned int,interval> &p) { return p.first == bd.b_col; });
+
+				if(l == limits.end())
+					l = limits.insert(limits.end(),std::make_pair(bd.b_col,interval()));
+
+				switch(bd.type)
+				{
+					case constraint::Less: l->second.upper(r[bd.a_col],true); break;
+					case constraint::LessOrEqual: l->second.upper(r[bd.a_col],false); break;
+					case constraint::Greater: l->second.lower(r[bd.a_col],true); break;
+					case constraint::GreaterOrEqual: l->second.lower(r[bd.a_col],false); break;
+				}
+			}
+
+			if(scan)
+				b_rel->range(limits.front().first,limits.front().second,b_idx);
+			else
+				b_rel->find(binding,b_idx);
+
+			if(!limits.empty())
+			{
+				b_idx.erase(std::remove_if(b_idx.begin(),b_idx.end(),[&](unsigned int i)
+				{
+					return std::any_of(limits.begin(),limits.end(),[&](const std::pair<unsigned int,interval> &l) { return !l.second.contains(b_rel->column(l.first)[i]); });
+				}),b_idx.end());
+			}
+
+			if(b_idx.empty())
+				continue;
+
+			unsigned int col = 0;
+			while(col < r.size())
+			{
+				nr[col] = r[col];
+				++col;
+			}
+
+			for(unsigned int b_ri: b_idx)
+			{
+				const relation::row_view s = b_rel->rows()[b_ri];
+
+				col = 0;
+				while(col < s.size())
+				{
+					nr[r.size() + col] = s[col];
+					++col;
+				}
+				if(!keep || (*keep)(nr.data()))
+					out->insert(nr.data(),nr.size());
+			}
+		}
+	};
+
+	if(pool && pool->size() > 1 && outer.size() >= partition)
+	{
+		const unsigned int n = pool->size();
+		std::vector<rel_ptr> parts(n);
+		counters *const cnt = current_counters;
+
+		pool->run(n,[&](unsigned int t)
+		{
+			current_counters = cnt;
+			parts[t] = rel_ptr(new relation(a_bind.size() + b_bind.size()));
+			probe(outer.size() * t / n,outer.size() * (t + 1) / n,parts[t]);
+			current_counters = 0;
+		});
+
+		for(rel_ptr p: parts)
+			ret->insert(p);
+	}
+	else
+		probe(0,outer.size(),ret);
+
+	if(current_counters)
+	{
+		size_t peak = current_counters->peak;
+		while(peak < ret->rows().size() && !current_counters->peak.compare_exchange_weak(peak,ret->rows().size()));
+	}
+
+	return ret;
+}
+
+// body atom projected onto its free variables, columns ordered by variable number and
+// rows sorted lexicographically. rows sharing a prefix form a contiguous range, which
+// makes the flat array usable as a trie by leapfrog_join().
+struct trie
+{
+	std::vector<unsigned int> vars;	// variable number of each column
+	std::vector<value> data;
+	size_t lo, hi;									// current range
+
+	value key(size_t row, unsigned int depth) const { return data[row * vars.size() + depth]; }
+};
+
+// first row in [from,t.hi) with a key >= k at 'depth'. gallops before the binary search
+// so that seeks over short distances stay cheap.
+size_t seek(const trie &t, size_t from, unsigned int depth, value k)
+{
+	size_t step = 1, lo = from, hi = from;
+
+	while(hi < t.hi && t.key(hi,depth) < k)
+	{
+		lo = hi + 1;
+		hi = std::min(hi + step,t.hi);
+		step <<= 1;
+	}
+
+	while(lo < hi)
+	{
+		size_t mid = lo + (hi - lo) / 2;
+
+		if(t.key(mid,depth) < k)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+// worst-case optimal evaluation of all non-negated atoms of 'r' by leapfrog triejoin, each
+// restricted to its 'bounds'. returns a relation with one column per free variable,
+// 'binding' names the columns.
+rel_ptr leapfrog_join(const rule_ptr r, const std::vector<rel_ptr> &relations, const std::vector<column_bounds> &bounds, std::vector<variable> &binding)
+{
+	std::vector<std::string> vars;	// variable number -> name, in order of first occurrence
+	std::vector<trie> tries;
+	std::vector<std::vector<unsigned int>> participants;	// variable number -> tries
+	unsigned int pi = 0;
+
+	binding.clear();
+	for(const predicate &p: r->body)
+	{
+		if(!p.negated)
+			for(const variable &v: p.variables)
+				if(!v.bound && std::find(vars.begin(),vars.end(),v.name) == vars.end())
+				{
+					vars.push_back(v.name);
+					binding.push_back(v);
+				}
+	}
+
+	rel_ptr ret(new relation(vars.size()));
+	participants.resize(vars.size());
+
+	for(const predicate &p: r->body)
+	{
+		const rel_ptr rel = relations[pi];
+		std::vector<unsigned int> order;
+		std::vector<unsigned int> cols; // trie column -> relation column
+
+		if(p.negated)
+		{
+			++pi;
+			continue;
+		}
+
+		matching(rel,p.variables,bounds[pi++],order);
+
+		if(order.empty())
+			return ret;
+
+		tries.push_back(trie());
+		trie &t = tries.back();
+
+		for(unsigned int v = 0; v < vars.size(); ++v)
+		{
+			auto i = std::find_if(p.variables.begin(),p.variables.end(),[&](const variable &w) { return !w.bound && w.name == vars[v]; });
+
+			if(i != p.variables.end())
+			{
+				t.vars.push_back(v);
+				cols.push_back(std::distance(p.variables.begin(),i));
+				participants[v].push_back(tries.size() - 1);
+			}
+		}
+
+		// sort matching rows on the projected columns, dropping duplicates
+		auto less = [&](unsigned int a, unsigned int b)
+		{
+			for(unsigned int c: cols)
+				if(rel->column(c)[a] != rel->column(c)[b])
+					return rel->column(c)[a] < rel->column(c)[b];
+			return false;
+		};
+
+		std::sort(order.begin(),order.end(),less);
+		t.data.reserve(order.size() * cols.size());
+
+		auto k = order.begin();
+		while(k != order.end())
+		{
+			if(k == order.begin() || less(*std::prev(k),*k))
+				for(unsigned int c: cols)
+					t.data.push_back(rel->column(c)[*k]);
+			++k;
+		}
+
+		t.lo = 0;
+		t.hi = cols.empty() ? 1 : t.data.size() / cols.size();
+	}
+
+	relation::row assign(vars.size(),0);
+	std::function<void(unsigned int)> search;
+
+	search = [&](unsigned int v)
+	{
+		if(v == vars.size())
+		{
+			ret->insert(assign);
+			return;
+		}
+
+		const std::vector<unsigned int> &its = participants[v];
+		std::vector<size_t> pos(its.size()), depth(its.size());
+		unsigned int k;
+
+		for(k = 0; k < its.size(); ++k)
+		{
+			const trie &t = tries[its[k]];
+
+			pos[k] = t.lo;
+			depth[k] = std::distance(t.vars.begin(),std::find(t.vars.begin(),t.vars.end(),v));
+			if(t.lo == t.hi)
+				return;
+		}
+
+		while(true)
+		{
+			value mx = 0;
+			bool agree = true;
+
+			for(k = 0; k < its.size(); ++k)
+				mx = std::max(mx,tries[its[k]].key(pos[k],depth[k]));
+
+			for(k = 0; k < its.size(); ++k)
+			{
+				const trie &t = tries[its[k]];
+
+				pos[k] = seek(t,pos[k],depth[k],mx);
+				if(pos[k] == t.hi)
+					return;
+				agree &= t.key(pos[k],depth[k]) == mx;
+			}
+
+			if(!agree)
+				continue;
+
+			// all iterators agree on 'mx': narrow every trie to that key and descend
+			std::vector<std::pair<size_t,size_t>> saved(its.size());
+			bool done = false;
+
+			for(k = 0; k < its.size(); ++k)
+			{
+				trie &t = tries[its[k]];
+
+				saved[k] = std::make_pair(t.lo,t.hi);
+				t.lo = pos[k];
+				t.hi = mx == ~0u ? t.hi : seek(t,pos[k],depth[k],mx + 1);
+			}
+
+			assign[v] = mx;
+			search(v + 1);
+
+			for(k = 0; k < its.size(); ++k)
+			{
+				trie &t = tries[its[k]];
+
+				pos[k] = t.hi;
+				t.lo = saved[k].first;
+				t.hi = saved[k].second;
+				done |= pos[k] == t.hi;
+			}
+
+			if(done)
+				return;
+		}
+	};
+
+	search(0);
+	return ret;
+}
+
+// greedy join order for the non-negated atoms of 'r'. starts w/ the atom expected to
+// yield the fewest rows, then repeatedly adds the atom that shares a variable w/ the
+// atoms so far and has the fewest expected matches per probe. cross products are only
+// used if no remaining atom is connected. called for every eval_rule(), so the order
+// follows the delta sizes from iteration to iteration.
+std::vector<unsigned int> plan_joins(const rule_ptr r, const std::vector<rel_ptr> &relations)
+{
+	std::vector<unsigned int> ret, todo;
+	std::set<std::string> known;
+	unsigned int pi = 0;
+
+	for(const predicate &p: r->body)
+	{
+		if(!p.negated)
+			todo.push_back(pi);
+		++pi;
+	}
+
+	while(!todo.empty())
+	{
+		auto best = todo.end();
+		double best_cost = 0;
+		bool best_conn = false;
+		auto i = todo.begin();
+
+		while(i != todo.end())
+		{
+			const predicate &p = *std::next(r->body.begin(),*i);
+			const rel_ptr rel = relations[*i];
+			unsigned long long mask = 0;
+			unsigned int col = 0;
+			bool conn = false;
+
+			while(col < p.variables.size())
+			{
+				const variable &v = p.variables[col];
+
+				if(v.bound || known.count(v.name))
+				{
+					mask |= 1ull << col;
+					conn |= !v.bound;
+				}
+				++col;
+			}
+
+			double cost = rel->rows().empty() ? 0 : (double)rel->rows().size() / rel->distinct(mask);
+
+			if(best == todo.end() || (conn && !best_conn) || (conn == best_conn && cost < best_cost))
+			{
+				best = i;
+				best_cost = cost;
+				best_conn = conn;
+			}
+
+			++i;
+		}
+
+		for(const variable &v: std::next(r->body.begin(),*best)->variables)
+			if(!v.bound)
+				known.insert(v.name);
+
+		ret.push_back(*best);
+		todo.erase(best);
+	}
+
+	return ret;
+}
+
+eval_options::eval_options(void)
+: join(rule::Pairwise), threads(1), partition(4096), trace(0), graph(0)
+{
+	return;
+}
+
+tracer::~tracer(void) {}
+void tracer::skipped(const std::string &) {}
+void tracer::unsafe(const rule_ptr) {}
+void tracer::unstratifiable(const rule_ptr) {}
+void tracer::stratum(const std::set<std::string> &) {}
+void tracer::stratum_finish(const std::set<std::string> &) {}
+void tracer::iteration(unsigned int) {}
+void tracer::rule_start(const rule_ptr) {}
+void tracer::rule_finish(const rule_ptr, const rel_ptr, const rule_stats &) {}
+void tracer::derived(const rule_ptr, size_t) {}
+void tracer::delta(const std::string &, size_t) {}
+
+rule_stats::rule_stats(void)
+: seconds(0), produced(0), probes(0), peak(0)
+{
+	return;
+}
+
+stream_tracer::stream_tracer(std::ostream &os)
+: m_stream(os)
+{
+	return;
+}
+
+void stream_tracer::skipped(const std::string &pred)
+{
+	m_stream << "skipping " << pred << std::endl;
+}
+
+void stream_tracer::unsafe(const rule_ptr r)
+{
+	m_stream << *r << " is not safe!" << std::endl;
+}
+
+void stream_tracer::unstratifiable(const rule_ptr r)
+{
+	m_stream << *r << " is not stratifiable!" << std::endl;
+}
+
+void stream_tracer::stratum(const std::set<std::string> &preds)
+{
+	m_stream << "stratum:";
+	for(const std::string &s: preds)
+		m_stream << " " << s;
+	m_stream << std::endl;
+}
+
+void stream_tracer::iteration(unsigned int n)
+{
+	if(n)
+		m_stream << "recursive delta #" << n << ":" << std::endl;
+	else
+		m_stream << "one shot:" << std::endl;
+}
+
+void stream_tracer::rule_finish(const rule_ptr r, const rel_ptr res, const rule_stats &)
+{
+	std::lock_guard<std::mutex> guard(m_lock);
+
+	m_stream << *r << std::endl;
+	if(res)
+		m_stream << *res << std::endl;
+}
+
+void stream_tracer::delta(const std::string &pred, size_t rows)
+{
+	m_stream << pred << ": " << rows << " new" << std::endl;
+}
+
+void profiler::stratum(const std::set<std::string> &preds)
+{
+	m_strata.push_back(stratum_entry());
+	m_strata.back().preds = preds;
+	m_strata.back().seconds = 0;
+	m_strata.back().iterations = 0;
+	m_index.clear();
+	m_start = std::chrono::steady_clock::now();
+}
+
+void profiler::stratum_finish(const std::set<std::string> &)
+{
+	assert(!m_strata.empty());
+	m_strata.back().seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+}
+
+void profiler::iteration(unsigned int n)
+{
+	if(!m_strata.empty())
+		m_strata.back().iterations = std::max(m_strata.back().iterations,n);
+}
+
+void profiler::rule_finish(const rule_ptr r, const rel_ptr, const rule_stats &st)
+{
+	std::lock_guard<std::mutex> guard(m_lock);
+	rule_entry &e = entry(r);
+
+	++e.calls;
+	e.seconds += st.seconds;
+	e.produced += st.produced;
+	e.probes += st.probes;
+	e.peak = std::max(e.peak,st.peak);
+}
+
+void profiler::derived(const rule_ptr r, size_t rows)
+{
+	std::lock_guard<std::mutex> guard(m_lock);
+	entry(r).fresh += rows;
+}
+
+const std::list<profiler::stratum_entry> &profiler::report(void) const
+{
+	return m_strata;
+}
+
+profiler::rule_entry &profiler::entry(const rule_ptr r)
+{
+	// rules evaluated outside of a stratum (e.g. by database::update()) get their own
+	if(m_strata.empty())
+		stratum(std::set<std::string>({r->head.name}));
+
+	std::vector<rule_entry> &rules = m_strata.back().rules;
+	auto i = m_index.find(r);
+
+	if(i == m_index.end())
+	{
+		i = m_index.insert(std::make_pair(r,rules.size())).first;
+		rules.push_back(rule_entry({r,0,0,0,0,0,0}));
+	}
+
+	return rules[i->second];
+}
+
+std::ostream &operator<<(std::ostream &os, const profiler &p)
+{
+	for(const profiler::stratum_entry &s: p.report())
+	{
+		std::vector<profiler::rule_entry> rules(s.rules);
+
+		os << "stratum {";
+		for(const std::string &n: s.preds)
+			os << (n == *s.preds.begin() ? "" : ", ") << n;
+		os << "}: " << std::fixed << std::setprecision(6) << s.seconds << "s, " << s.iterations << " iterations" << std::endl;
+
+		std::sort(rules.begin(),rules.end(),[](const profiler::rule_entry &a, const profiler::rule_entry &b) { return a.seconds > b.seconds; });
+		for(const profiler::rule_entry &r: rules)
+		{
+			os << "  " << *r.rule << std::endl;
+			os << "    time=" << r.seconds << "s calls=" << r.calls << " produced=" << r.produced << " new=" << r.fresh
+				 << " probes=" << r.probes << " peak=" << r.peak << std::endl;
+		}
+	}
+
+	return os;
+}
+
+// first column of 'vars' holding the free variable 'name'
+static int column_of(const std::vector<variable> &vars, const std::string &name)
+{
+	auto i = std::find_if(vars.begin(),vars.end(),[&](const variable &v) { return !v.bound && v.name == name; });
+	return i == vars.end() ? -1 : std::distance(vars.begin(),i);
+}
+
+// constraints of 'r' between a variable only in 'b_bind' and one in 'a_bind'
+static std::vector<band> bands_for(const rule_ptr r, const std::vector<variable> &a_bind, const std::vector<variable> &b_bind)
+{
+	std::vector<band> ret;
+
+	for(const constraint &c: r->constraints)
+	{
+		if(c.operand1.bound || c.operand2.bound)
+			continue;
+
+		const int b1 = column_of(b_bind,c.operand1.name), b2 = column_of(b_bind,c.operand2.name);
+		const int a1 = column_of(a_bind,c.operand1.name), a2 = column_of(a_bind,c.operand2.name);
+
+		if(b1 >= 0 && a1 < 0 && a2 >= 0)
+			ret.push_back(band({(unsigned int)b1,c.type,(unsigned int)a2}));
+		else if(b2 >= 0 && a2 < 0 && a1 >= 0)
+			ret.push_back(band({(unsigned int)b2,constraint::flip(c.type),(unsigned int)a1}));
+	}
+
+	return ret;
+}
+
+rel_ptr eval_rule(const rule_ptr r, const std::vector<rel_ptr> &relations, const eval_options &opts, thread_pool *pool)
+{
+	assert(r);
+
+	// constraints w/ a constant restrict the rows read from the atoms
+	std::vector<column_bounds> bounds(r->body.size());
+
+	if(!r->constraints.empty())
+	{
+		unsigned int pi = 0;
+
+		for(const predicate &p: r->body)
+		{
+			if(!p.negated)
+				bounds[pi] = bounds_for(r,p);
+			++pi;
+		}
+	}
+
+	rel_ptr temp(new relation());
+	std::vector<variable> binding;
+	const unsigned int positive = std::count_if(r->body.begin(),r->body.end(),[](const predicate &p) { return !p.negated; });
+
+	// facts
+	if(r->body.empty())
+	{
+		relation::row nr;
+
+		for(const variable &v: r->head.variables)
+			nr.push_back(v.instantiation);
+		temp->insert(nr);
+
+		return temp;
+	}
+
+	bool filtered = false; // constraints and negated atoms already applied
+
+	// non-negated predicates
+	if(positive > 1 && (r->join == rule::Default ? opts.join : r->join) == rule::Leapfrog)
+	{
+		temp = leapfrog_join(r,relations,bounds,binding);
+	}
+	else if(positive > 1)
+	{
+		std::vector<unsigned int> order = plan_joins(r,relations);
+		std::vector<variable> layout; // columns of the last join's output
+		auto i = order.begin();
+
+		for(unsigned int o: order)
+		{
+			const std::vector<variable> &vars = std::next(r->body.begin(),o)->variables;
+			layout.insert(layout.end(),vars.begin(),vars.end());
+		}
+
+		// the last join drops rows failing constraints or negated atoms right away
+		const row_filter last(r,layout,relations);
+		filtered = !last.empty();
+
+		while(i != order.end())
+		{
+			const predicate &p = *std::next(r->body.begin(),*i);
+			const row_filter *keep = std::next(i) == order.end() || (i == order.begin() && order.size() == 2) ? &last : 0;
+
+			if(i == order.begin())
+			{
+				const predicate &q = *std::next(r->body.begin(),*std::next(i));
+
+				temp = join(p.variables,relations[*i],q.variables,relations[*std::next(i)],pool,opts.partition,bands_for(r,p.variables,q.variables),bounds[*i],bounds[*std::next(i)],keep);
+				binding = p.variables;
+				std::copy(q.variables.begin(),q.variables.end(),std::inserter(binding,binding.end()));
+				++i;
+			}
+			else
+			{
+				temp = join(binding,temp,p.variables,relations[*i],pool,opts.partition,bands_for(r,binding,p.variables),column_bounds(),bounds[*i],keep);
+				std::copy(p.variables.begin(),p.variables.end(),std::inserter(binding,binding.end()));
+			}
+
+			++i;
+		}
+	}
+	else
+	{
+		unsigned int i = std::distance(r->body.begin(),std::find_if(r->body.begin(),r->body.end(),[](const predicate &p) { return !p.negated; }));
+		const rel_ptr rel = relations[i];
+		const std::vector<variable> &vars = std::next(r->body.begin(),i)->variables;
+
+		// the binding is needed by the filters below even if the atom is empty
+		binding = vars;
+		if(!rel->rows().empty())
+		{
+			std::vector<unsigned int> rows;
+
+			matching(rel,vars,bounds[i],rows);
+			for(unsigned int i: rows)
+				temp->insert(rel->rows()[i]);
+		}
+	}
+
+	// build index from varname to column number in temporary relation 'temp'
+	std::unordered_map<std::string,unsigned int> common; // varname -> temp rel column
+	auto j = binding.begin();
+	while(j != binding.end())
+	{
+		const variable &w = *j;
+		
+		if(!w.bound)
+			common.insert(std::make_pair(w.name,std::distance(binding.begin(),j)));
+		++j;
+	}
+
+	// project onto head predicate. constants are written once, variables copied per row.
+	// count and sum see every body binding, the other variables are kept after the head's.
+	const unsigned int agg = aggregate_column(r->head);
+	std::vector<variable> cols(r->head.variables);
+
+	if(agg < cols.size() && cols[agg].aggregate >= variable::Count)
+		for(const std::pair<const std::string,unsigned int> &v: common)
+			if(std::find(cols.begin(),cols.end(),binding[v.second]) == cols.end())
+				cols.push_back(binding[v.second]);
+
+	const unsigned int width = cols.size();
+	rel_ptr ret(new relation(width));
+	relation::row nr(width,0);
+	std::vector<std::pair<unsigned int,unsigned int>> copy; // head column <- temp column
+
+	for(unsigned int c = 0; c < width; ++c)
+	{
+		const variable &v = cols[c];
+
+		if(v.bound)
+			nr[c] = v.instantiation;
+		else
+			copy.push_back(std::make_pair(c,common[v.name]));
+	}
+
+	// constraints and negated atoms, unless the last join applied them
+	const row_filter keep(r,binding,relations);
+	const bool check = !filtered && !keep.empty();
+	relation::row cur(binding.size(),0);
+
+	for(const relation::row_view &rr: temp->rows())
+	{
+		if(check)
+		{
+			for(unsigned int c = 0; c < cur.size(); ++c)
+				cur[c] = rr[c];
+			if(!keep(cur.data()))
+				continue;
+		}
+
+		for(const std::pair<unsigned int,unsigned int> &cp: copy)
+			nr[cp.first] = rr[cp.second];
+		ret->insert(nr.data(),width);
+	}
+
+	return ret;
+}
+
+// all predicates 'query' depends upon, including itself
+std::set<std::string> depends(const std::multimap<std::string,rule_ptr> &idb, std::string query)
+{
+	std::set<std::string> ret({query});
+	std::list<std::string> todo({query});
+
+	while(!todo.empty())
+	{
+		std::for_each(idb.lower_bound(todo.front()),idb.upper_bound(todo.front()),[&](const std::pair<std::string,rule_ptr> &q)
+		{
+			for(const predicate &p: q.second->body)
+				if(ret.insert(p.name).second)
+					todo.push_back(p.name);
+		});
+		todo.pop_front();
+	}
+
+	return ret;
+}
+
+bool is_safe(rule_ptr r)
+{
+	// every variable in the head must apper in a non-negated predicate in the body
+	return r && std::all_of(r->head.variables.begin(),r->head.variables.end(),[&](const variable &v)
+	{
+		return v.bound || std::any_of(r->body.begin(),r->body.end(),[&](const predicate &p)
+		{
+			return !p.negated && std::find(p.variables.begin(),p.variables.end(),v) != p.variables.end();
+		});
+	}) && 
+	// every variable occuring in a negated prediacte in the body must occur in a non-negated one too
+	std::all_of(r->body.begin(),r->body.end(),[&](const predicate &p)
+	{
+		return !p.negated || std::all_of(p.variables.begin(),p.variables.end(),[&](const variable &v)
+		{
+			return v.bound || std::any_of(r->body.begin(),r->body.end(),[&](const predicate &q)
+			{
+				return !q.negated && std::find(q.variables.begin(),q.variables.end(),v) != q.variables.end();
+			});
+		});
+	}) &&
+	// same for the operands of constraints
+	std::all_of(r->constraints.begin(),r->constraints.end(),[&](const constraint &c)
+	{
+		auto positive = [&](const variable &v)
+		{
+			return v.bound || std::any_of(r->body.begin(),r->body.end(),[&](const predicate &q)
+			{
+				return !q.negated && std::find(q.variables.begin(),q.variables.end(),v) != q.variables.end();
+			});
+		};
+
+		return positive(c.operand1) && positive(c.operand2);
+	}) &&
+	// at most one aggregate, on a variable of the head
+	std::count_if(r->head.variables.begin(),r->head.variables.end(),[](const variable &v) { return v.aggregate != variable::None; }) <= 1 &&
+	std::none_of(r->head.variables.begin(),r->head.variables.end(),[](const variable &v) { return v.bound && v.aggregate != variable::None; }) &&
+	std::all_of(r->body.begin(),r->body.end(),[](const predicate &p)
+	{
+		return std::all_of(p.variables.begin(),p.variables.end(),[](const variable &v) { return v.aggregate == variable::None; });
+	});
+}
+
+void eval_rules(const std::vector<rule_ptr> &tasks, const std::vector<std::vector<rel_ptr>> &plans, std::vector<rel_ptr> &results, const eval_options &opts, thread_pool *pool)
+{
+	results.resize(tasks.size());
+
+	auto run = [&](unsigned int t, thread_pool *p)
+	{
+		if(!opts.trace)
+		{
+			results[t] = eval_rule(tasks[t],plans[t],opts,p);
+			return;
+		}
+
+		counters cnt;
+		rule_stats st;
+
+		opts.trace->rule_start(tasks[t]);
+		current_counters = &cnt;
+
+		const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		results[t] = eval_rule(tasks[t],plans[t],opts,p);
+
+		st.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		current_counters = 0;
+		st.produced = results[t] ? results[t]->rows().size() : 0;
+		st.probes = cnt.probes;
+		st.peak = cnt.peak;
+
+		opts.trace->rule_finish(tasks[t],results[t],st);
+	};
+
+	// w/ fewer tasks than workers evaluate them one after another and split their joins instead
+	if(pool && tasks.size() >= pool->size())
+		pool->run(tasks.size(),[&](unsigned int t) { run(t,0); });
+	else
+		for(unsigned int t = 0; t < tasks.size(); ++t)
+			run(t,pool);
+}
+
+dependency_graph::dependency_graph(void)
+{
+	return;
+}
+
+dependency_graph::dependency_graph(const std::multimap<std::string,rule_ptr> &idb)
+{
+	for(const std::pair<const std::string,rule_ptr> &p: idb)
+	{
+		const unsigned int h = id(p.first);
+
+		for(const predicate &q: p.second->body)
+		{
+			const unsigned int b = id(q.name);
+			m_edges[h].push_back(b);
+		}
+	}
+
+	// Tarjan's algorithm w/ an explicit stack. components are completed dependencies first.
+	const unsigned int none = ~0u, n = m_names.size();
+	std::vector<unsigned int> index(n,none), low(n,0), stack;
+	std::vector<std::pair<unsigned int,unsigned int>> call;	// node, next edge
+	std::vector<bool> on_stack(n,false);
+	unsigned int counter = 0, components = 0;
+
+	m_component.assign(n,none);
+
+	auto visit = [&](unsigned int v)
+	{
+		index[v] = low[v] = counter++;
+		stack.push_back(v);
+		on_stack[v] = true;
+		call.push_back(std::make_pair(v,0));
+	};
+
+	for(unsigned int v = 0; v < n; ++v)
+	{
+		if(index[v] != none)
+			continue;
+
+		visit(v);
+		while(!call.empty())
+		{
+			const unsigned int u = call.back().first;
+
+			if(call.back().second < m_edges[u].size())
+			{
+				const unsigned int w = m_edges[u][call.back().second++];
+
+				if(index[w] == none)
+					visit(w);
+				else if(on_stack[w])
+					low[u] = std::min(low[u],index[w]);
+				continue;
+			}
+
+			call.pop_back();
+			if(!call.empty())
+				low[call.back().first] = std::min(low[call.back().first],low[u]);
+
+			if(low[u] == index[u])
+			{
+				unsigned int w;
+
+				do
+				{
+					w = stack.back();
+					stack.pop_back();
+					on_stack[w] = false;
+					m_component[w] = components;
+				}
+				while(w != u);
+				++components;
+			}
+		}
+	}
+
+	// negation, count and sum within a component
+	for(const std::pair<const std::string,rule_ptr> &p: idb)
+	{
+		const unsigned int agg = aggregate_column(p.second->head);
+		const bool tally = agg < p.second->head.variables.size() && p.second->head.variables[agg].aggregate >= variable::Count;
+
+		if(std::any_of(p.second->body.begin(),p.second->body.end(),[&](const predicate &q) { return (q.negated || tally) && m_component[m_ids.at(q.name)] == m_component[m_ids.at(p.first)]; }))
+			m_cycles.push_back(p.second);
+	}
+}
+
+unsigned int dependency_graph::id(const std::string &name)
+{
+	auto i = m_ids.insert(std::make_pair(name,m_names.size()));
+
+	if(i.second)
+	{
+		m_names.push_back(name);
+		m_edges.push_back(std::vector<unsigned int>());
+	}
+
+	return i.first->second;
+}
+
+std::set<std::string> dependency_graph::depends(const std::string &query) const
+{
+	std::set<std::string> ret({query});
+	auto i = m_ids.find(query);
+
+	if(i == m_ids.end())
+		return ret;
+
+	std::vector<bool> seen(m_names.size(),false);
+	std::vector<unsigned int> todo({i->second});
+
+	seen[i->second] = true;
+	while(!todo.empty())
+	{
+		const unsigned int v = todo.back();
+
+		todo.pop_back();
+		ret.insert(m_names[v]);
+		for(unsigned int w: m_edges[v])
+			if(!seen[w])
+			{
+				seen[w] = true;
+				todo.push_back(w);
+			}
+	}
+
+	return ret;
+}
+
+std::list<std::set<std::string>> dependency_graph::stratify(const std::set<std::string> &preds) const
+{
+	std::map<unsigned int,std::set<std::string>> comps;
+	std::list<std::set<std::string>> ret;
+
+	for(const std::string &p: preds)
+	{
+		auto i = m_ids.find(p);
+
+		// unknown predicates depend on nothing
+		if(i == m_ids.end())
+			ret.push_back(std::set<std::string>({p}));
+		else
+			comps[m_component[i->second]].insert(p);
+	}
+
+	for(const std::pair<const unsigned int,std::set<std::string>> &c: comps)
+		ret.push_back(c.second);
+
+	return ret;
+}
+
+const std::vector<rule_ptr> &dependency_graph::cycles(void) const
+{
+	return m_cycles;
+}
+
+std::list<std::set<std::string>> stratify(const std::multimap<std::string,rule_ptr> &idb, const std::set<std::string> &preds)
+{
+	return dependency_graph(idb).stratify(preds);
+}
+
+bool is_recursive(const rule_ptr r, const std::set<std::string> &stratum)
+{
+	return std::any_of(r->body.begin(),r->body.end(),[&](const predicate &p) { return stratum.count(p.name) > 0; });
+}
+
+unsigned int aggregate_column(const predicate &head)
+{
+	return std::distance(head.variables.begin(),std::find_if(head.variables.begin(),head.variables.end(),[](const variable &v) { return v.aggregate != variable::None; }));
+}
+
+// folds 'res' into 'rel' keeping the least (Min) or greatest (Max) value of column 'col'
+// per group of the other columns. rows not better than their group in 'known' (may be 0)
+// are skipped. returns the number of groups added or improved.
+size_t fold(relation &rel, const relation &res, unsigned int col, variable::Aggregate type, const relation *known)
+{
+	assert(type == variable::Min || type == variable::Max);
+
+	if(res.rows().empty())
+		return 0;
+
+	std::vector<variable> key(res.arity(),variable(true,0u,""));
+	std::vector<unsigned int> hits;
+	relation::row nr(res.arity());
+	size_t ret = 0;
+
+	key[col] = variable(false,0u,"_");
+
+	// best value of the group of 'key' in 'r', if any
+	auto best = [&](const relation &r, value &v)
+	{
+		r.find(key,hits);
+		if(hits.empty())
+			return false;
+		v = r.rows()[hits.front()][col];
+		return true;
+	};
+
+	for(const relation::row_view &row: res.rows())
+	{
+		const value v = row[col];
+		value b;
+
+		for(unsigned int c = 0; c < nr.size(); ++c)
+			key[c].instantiation = nr[c] = row[c];
+
+		if(known && best(*known,b) && !(type == variable::Min ? value_less(v,b) : value_less(b,v)))
+			continue;
+
+		if(best(rel,b))
+		{
+			if(!(type == variable::Min ? value_less(v,b) : value_less(b,v)))
+				continue;
+
+			nr[col] = b;
+			rel.remove(nr);
+			nr[col] = v;
+		}
+
+		rel.insert(nr);
+		++ret;
+	}
+
+	return ret;
+}
+
+// adds the rows of 'res', one per distinct body binding, to the number (Count) or sum
+// (Sum) of column 'col' of their group. groups are the other of the first 'width' columns,
+// the columns after those hold the remaining body variables. strings aren't summed.
+void tally(std::map<relation::row,unsigned int> &groups, const relation &res, unsigned int width, unsigned int col, variable::Aggregate type)
+{
+	assert(type == variable::Count || type == variable::Sum);
+
+	for(const relation::row_view &row: res.rows())
+	{
+		relation::row g(width,0);
+
+		for(unsigned int c = 0; c < width; ++c)
+			g[c] = c == col ? 0 : row[c];
+
+		unsigned int &acc = groups[g];
+		const variant v = decode(row[col]);
+
+		if(type == variable::Count)
+			++acc;
+		else if(v.type() == typeid(unsigned int))
+			acc += boost::get<unsigned int>(v);
+	}
 }
 
-variable find_helper(variant v)
+bool fixpoint(const std::set<std::string> &stratum, const std::vector<rule_ptr> &recursive, std::map<std::string,rel_ptr> &rels, std::map<std::string,rel_ptr> &deltas, std::map<std::string,rel_ptr> *old, std::map<std::string,rel_ptr> *added, const eval_options &opts, thread_pool *pool, const emitter &emit)
 {
-	return variable(true,v,"");
-}*/
+	bool modified;
+	unsigned int iteration = 0;
+	std::map<std::string,std::pair<unsigned int,variable::Aggregate>> aggs; // min/max heads
 
-rel_ptr join(const std::vector<variable> &a_bind,const rel_ptr a_rel,const std::vector<variable> &b_bind,const rel_ptr b_rel)
-{
-	assert(a_rel && b_rel);
-	std::set<unsigned int> *a_idx = a_rel->find(a_bind);
-	std::multimap<unsigned int,unsigned int> cross_vars; // a -> b
-	rel_ptr ret(new relation());
+	for(const rule_ptr r: recursive)
+	{
+		const unsigned int col = aggregate_column(r->head);
 
-	if(!a_idx)
-		return ret;
+		if(col < r->head.variables.size())
+			aggs[r->head.name] = std::make_pair(col,r->head.variables[col].aggregate);
+	}
 
-	auto i = a_bind.begin();
-	while(i != a_bind.end())
+	// 'rel' := 'rel' + 'add', for aggregates w/ the better tuple replacing the known one
+	auto merge = [&](const std::string &s, relation &rel, const rel_ptr add)
 	{
-		if(!i->bound)
+		auto a = aggs.find(s);
+
+		if(a == aggs.end())
+			rel.insert(add);
+		else
+			fold(rel,*add,a->second.first,a->second.second,0);
+	};
+
+	do
+	{
+		std::map<std::string,rel_ptr> new_deltas;
+		std::vector<rule_ptr> tasks;
+		std::vector<std::vector<rel_ptr>> plans;
+		std::vector<rel_ptr> results;
+
+		modified = false;
+		for(const rule_ptr r: recursive)
 		{
-			auto j = b_bind.begin();
-			while(j != b_bind.end())
+			assert(r);
+			unsigned int di = 0;
+
+			// one variant per body atom 'di' of this stratum: delta on 'di', old before and full after it
+			while(di < r->body.size())
 			{
-				if(!j->bound && i->name ==j->name)
-			 		cross_vars.insert(std::make_pair(std::distance(a_bind.begin(),i),std::distance(b_bind.begin(),j)));
-				++j;
+				const predicate &dp = *std::next(r->body.begin(),di);
+
+				if(!dp.negated && stratum.count(dp.name) && deltas.count(dp.name) && !deltas[dp.name]->rows().empty())
+				{
+					std::vector<rel_ptr> plan;
+					unsigned int pi = 0;
+
+					for(const predicate &p: r->body)
+					{
+						if(!stratum.count(p.name) || pi > di || (pi < di && !old))
+							plan.push_back(rels[p.name]);
+						else if(pi == di)
+							plan.push_back(deltas[p.name]);
+						else
+							plan.push_back((*old)[p.name]);
+						++pi;
+					}
+
+					tasks.push_back(r);
+					plans.push_back(plan);
+				}
+
+				++di;
 			}
 		}
-		++i;
-	}
 
-	for(unsigned int a_ri: *a_idx)
-	{	
-		const relation::row &r = a_rel->rows()[a_ri];
-		std::vector<variable> binding(b_bind);
+		if(opts.trace)
+			opts.trace->iteration(++iteration);
 
-		for(const std::pair<unsigned int,unsigned int> &xv: cross_vars)
-		{
-			binding[xv.second].instantiation = variant(r[xv.first]);
-			binding[xv.second].bound = true;
-		}
+		// rule variants only read the current relations and are evaluated independently
+		eval_rules(tasks,plans,results,opts,pool);
 
-		std::set<unsigned int> *b_idx = b_rel->find(binding);
-		if(b_idx)
+		for(unsigned int t = 0; t < tasks.size(); ++t)
 		{
-			for(unsigned int b_ri: *b_idx)
+			const rule_ptr r = tasks[t];
+			const rel_ptr res = results[t];
+
+			if(res)
 			{
-				relation::row nr(r);
-				const relation::row &s = b_rel->rows()[b_ri];
+				const rel_ptr cur = rels[r->head.name];
+				rel_ptr &nd = new_deltas[r->head.name];
 
-				std::copy(s.begin(),s.end(),std::inserter(nr,nr.end()));
-				ret->insert(nr);
+				if(!nd)
+					nd = rel_ptr(new relation());
+
+				size_t fresh = 0;
+				auto a = aggs.find(r->head.name);
+
+				// only tuples improving on their group become deltas
+				if(a != aggs.end())
+					fresh = fold(*nd,*res,a->second.first,a->second.second,cur.get());
+				else
+					for(const relation::row_view &row: res->rows())
+						if(!cur->includes(row))
+							fresh += nd->insert(row);
+
+				if(opts.trace)
+					opts.trace->derived(r,fresh);
 			}
-			delete b_idx;
 		}
+
+		// old := old + delta, delta := new, full := full + new
+		for(const std::string &s: stratum)
+		{
+			if(old)
+				merge(s,*(*old)[s],deltas[s]);
+			deltas[s] = new_deltas.count(s) ? new_deltas[s] : rel_ptr(new relation());
+			merge(s,*rels[s],deltas[s]);
+			if(added)
+				merge(s,*(*added)[s],deltas[s]);
+			if(opts.trace)
+				opts.trace->delta(s,deltas[s]->rows().size());
+			modified |= !deltas[s]->rows().empty();
+		}
+
+		if(emit)
+			for(const std::string &s: stratum)
+				if(!deltas[s]->rows().empty() && !emit(s,*deltas[s]))
+					return false;
 	}
+	while(modified);
 
-	delete a_idx;
-	return ret;
+	return true;
 }
 
-rel_ptr eval_rule(const rule_ptr r, const std::vector<rel_ptr> &relations)
+bool eval_stratum(const std::set<std::string> &stratum, const std::multimap<std::string,rule_ptr> &idb, std::map<std::string,rel_ptr> &rels, const eval_options &opts, thread_pool *pool, const emitter &emit)
 {
-	assert(r);
-
-	rel_ptr temp(new relation());
-	std::vector<variable> binding;
-
-	if(r->body.empty())
-		return temp;
+	std::vector<rule_ptr> simple, recursive;
+	std::map<std::string,rel_ptr> deltas, old;
+	std::map<std::string,std::map<relation::row,unsigned int>> tallied;
+	bool aggregated = false;
 
-	// non-negated predicates
-	if(std::count_if(r->body.begin(),r->body.end(),[](const predicate &p) { return !p.negated; }) > 1)
+	for(const std::string &s: stratum)
 	{
-		auto i = r->body.begin();
-		bool first = true;
-
-		while(i != r->body.end())
+		std::for_each(idb.lower_bound(s),idb.upper_bound(s),[&](const std::pair<std::string,rule_ptr> &p)
 		{
-			if(!i->negated)
-			{
-				if(first)
-				{
-					unsigned int j = std::distance(r->body.begin(),i);
-					temp = join(i->variables,relations[j],std::next(i)->variables,relations[j+1]);
-					binding = i->variables;
-
-					++i;
-					first = false;
-				}
-				else
-				{
-					temp = join(binding,temp,i->variables,relations[std::distance(r->body.begin(),i)]);
-				}
-				
-				std::copy(i->variables.begin(),i->variables.end(),std::inserter(binding,binding.end()));
-			}
+			aggregated |= aggregate_column(p.second->head) < p.second->head.variables.size();
 
+			if(is_recursive(p.second,stratum))
+				recursive.push_back(p.second);
+			else
+				simple.push_back(p.second);
 
-			++i;
-		}
-	}
-	else
-	{
-		unsigned int i = std::distance(r->body.begin(),std::find_if(r->body.begin(),r->body.end(),[](const predicate &p) { return !p.negated; }));
-		const rel_ptr rel = relations[i];
-		const std::vector<variable> &vars = std::next(r->body.begin(),i)->variables;
-		std::set<unsigned int> *s = rel->find(vars);
+			// predicates w/o facts or rules are empty
+			for(const predicate &q: p.second->body)
+				if(!rels.count(q.name))
+					rels.insert(std::make_pair(q.name,rel_ptr(new relation())));
+		});
 
-		if(s)
-		{
-			for(unsigned int i: *s)
-				temp->insert(rel->rows()[i]);
-			binding = vars;
-			delete s;
-		}
+		if(!rels.count(s))
+			rels.insert(std::make_pair(s,rel_ptr(new relation())));
 	}
 
-	// build index from varname to column number in temporary relation 'temp'
-	std::unordered_map<std::string,unsigned int> common; // varname -> temp rel column
-	auto j = binding.begin();
-	while(j != binding.end())
+	if(opts.trace)
 	{
-		const variable &w = *j;
-		
-		if(!w.bound)
-			common.insert(std::make_pair(w.name,std::distance(binding.begin(),j)));
-		++j;
+		opts.trace->stratum(stratum);
+		opts.trace->iteration(0);
 	}
 
-	// negated predicates
-	auto i = r->body.begin();
+	// aggregates may still improve, they're emitted once complete
+	const emitter each = aggregated ? emitter() : emit;
 
-	while(i != r->body.end())
+	// eval all rules w/ body predicates in lower strata once
 	{
-		if(i->negated)
+		std::vector<std::vector<rel_ptr>> plans;
+		std::vector<rel_ptr> results;
+
+		for(rule_ptr r: simple)
 		{
-			rel_ptr rel = relations[std::distance(r->body.begin(),i)];
-			relation::row b(i->variables.size(),"");
-			unsigned int j = 0;
+			assert(r);
+			plans.push_back(std::vector<rel_ptr>());
+			for(const predicate &p: r->body)
+				plans.back().push_back(rels[p.name]);
+		}
 
-			while(j < i->variables.size())
-			{
-				if(i->variables[j].bound)
-					b[j] = i->variables[j].instantiation;
-				++j;
-			}
+		eval_rules(simple,plans,results,opts,pool);
 
-			temp->reject([&](const relation::row &r) -> bool
+		for(unsigned int t = 0; t < simple.size(); ++t)
+		{
+			if(results[t])
 			{
-				j = 0;
+				const predicate &h = simple[t]->head;
+				const rel_ptr head = rels[h.name];
+				const size_t before = head->rows().size();
+				const unsigned int col = aggregate_column(h);
+				size_t fresh_rows = 0;
 
-				while(j < i->variables.size())
+				if(col < h.variables.size() && h.variables[col].aggregate >= variable::Count)
 				{
-					if(!i->variables[j].bound)
-						b[j] = r[common[i->variables[j].name]];
-					++j;
+					// written once all rules are done
+					tally(tallied[h.name],*results[t],h.variables.size(),col,h.variables[col].aggregate);
+					continue;
 				}
-				
-				return rel->includes(b);
-			});
+				else if(col < h.variables.size())
+					fresh_rows = fold(*head,*results[t],col,h.variables[col].aggregate,0);
+				else if(each)
+				{
+					relation fresh;
+
+					for(const relation::row_view &row: results[t]->rows())
+						if(head->insert(row))
+							fresh.insert(row);
+
+					if(!fresh.rows().empty() && !each(h.name,fresh))
+					{
+						if(opts.trace)
+							opts.trace->stratum_finish(stratum);
+						return false;
+					}
+				}
+				else
+					head->insert(results[t]);
+
+				if(opts.trace)
+					opts.trace->derived(simple[t],col < h.variables.size() ? fresh_rows : head->rows().size() - before);
+			}
 		}
 
-		++i;
+		for(const std::pair<const std::string,std::map<relation::row,unsigned int>> &t: tallied)
+		{
+			const unsigned int col = aggregate_column(idb.find(t.first)->second->head);
+
+			for(const std::pair<const relation::row,unsigned int> &g: t.second)
+			{
+				relation::row nr(g.first);
+
+				nr[col] = encode(variant(g.second));
+				rels[t.first]->insert(nr);
+			}
+		}
 	}
-	
-	// project onto head predicate
-	rel_ptr ret(new relation());
-	for(const relation::row &rr: temp->rows())
-	{
-		relation::row nr;
 
-		for(const variable &v: r->head.variables)
-			if(v.bound)
-				nr.push_back(v.instantiation);
-			else
-				nr.push_back(rr[common[v.name]]);
-		ret->insert(nr);
+	// semi-naive iteration. every predicate in this stratum has three versions: 'old'
+	// (known before the last iteration), 'deltas' (new in the last iteration) and the
+	// full relation in 'rels' (old + delta).
+	for(const std::string &s: stratum)
+	{
+		old.insert(std::make_pair(s,rel_ptr(new relation())));
+		deltas.insert(std::make_pair(s,rel_ptr(new relation())));
+		deltas[s]->insert(rels[s]);
 	}
 
-	return ret;
-}
+	bool done = fixpoint(stratum,recursive,rels,deltas,&old,0,opts,pool,each);
 
-bool derives(const std::multimap<std::string,rule_ptr> &idb, std::string a, std::string b)
-{
-	std::set<std::string> known;
-	std::function<bool(const rule_ptr)> check;
-	
-	check = [&](const rule_ptr r)
-	{
-		return any_of(r->body.begin(),r->body.end(),[&](const predicate &p) 
-		{ 
-			return p.name == b || 
-						 (known.insert(p.name).second && any_of(idb.lower_bound(p.name),idb.upper_bound(p.name),[&](const std::pair<std::string,rule_ptr> &q)
-						 		{ return check(q.second); }));
-		});
-	};
-	return any_of(idb.lower_bound(a),idb.upper_bound(a),[&](const std::pair<std::string,rule_ptr> &q) { return check(q.second); });
-}
+	if(emit && aggregated)
+		for(const std::string &s: stratum)
+			if(done && !rels[s]->rows().empty())
+				done = emit(s,*rels[s]);
 
-bool mutual_rec(const std::multimap<std::string,rule_ptr> &idb, std::string a, std::string b)
-{
-	return a == b || (derives(idb,a,b) && derives(idb,b,a));
+	if(opts.trace)
+		opts.trace->stratum_finish(stratum);
+
+	return done;
 }
 
-bool is_safe(rule_ptr r)
+rel_ptr eval(std::string query, std::multimap<std::string,rule_ptr> &idb, std::map<std::string,rel_ptr> &edb, const eval_options &opts)
 {
-	// every variable in the head must apper in a non-negated predicate in the body
-	return r && std::all_of(r->head.variables.begin(),r->head.variables.end(),[&](const variable &v)
-	{
-		return v.bound || std::any_of(r->body.begin(),r->body.end(),[&](const predicate &p)
-		{
-			return !p.negated && std::find(p.variables.begin(),p.variables.end(),v) != p.variables.end();
-		});
-	}) && 
-	// every variable occuring in a negated prediacte in the body must occur in a non-negated one too
-	std::all_of(r->body.begin(),r->body.end(),[&](const predicate &p)
-	{
-		return !p.negated || std::all_of(p.variables.begin(),p.variables.end(),[&](const variable &v)
-		{
-			return v.bound || std::any_of(r->body.begin(),r->body.end(),[&](const predicate &q)
-			{
-				return !q.negated && std::find(q.variables.begin(),q.variables.end(),v) != q.variables.end();
-			});
-		});
-	});
+	return eval(query,idb,edb,opts,emitter());
 }
 
-rel_ptr eval(std::string query, std::multimap<std::string,rule_ptr> &idb, std::map<std::string,rel_ptr> &edb)
+// 'emit' sees the tuples of the last stratum, the one w/ 'query'
+rel_ptr eval(std::string query, std::multimap<std::string,rule_ptr> &idb, std::map<std::string,rel_ptr> &edb, const eval_options &opts, const emitter &emit)
 {
-	// TODO only include rules that 'query' depends upon
-	
-	std::list<std::string> partition; // result of partitioning the idb predicates with mutual_rec()
+	// w/o a cached graph the idb is analyzed on every call
+	std::unique_ptr<dependency_graph> own(opts.graph ? 0 : new dependency_graph(idb));
+	const dependency_graph &graph = opts.graph ? *opts.graph : *own;
+	const std::set<std::string> needed = graph.depends(query);
+	std::set<std::string> partition, skipped;
 
+	// only rules 'query' depends upon are evaluated
 	for(const std::pair<std::string,rule_ptr> &p: idb)
 	{
+		if(!needed.count(p.first))
+		{
+			if(skipped.insert(p.first).second && opts.trace)
+				opts.trace->skipped(p.first);
+			continue;
+		}
 		if(!is_safe(p.second))
 		{
-			std::cout << *p.second << " is not safe!" << std::endl;
+			if(opts.trace)
+				opts.trace->unsafe(p.second);
 			return rel_ptr(0);
 		}
-		if(std::find(partition.begin(),partition.end(),p.first) == partition.end())
-			partition.push_back(p.first);
+		partition.insert(p.first);
 	}
 
-	partition.sort([&](const std::string &a, const std::string &b) -> bool
+	for(const rule_ptr r: graph.cycles())
 	{
-		if(a == b)
-			return false;
-
-		int ab = derives(idb,a,b);
-		int ba = derives(idb,b,a);
-
-		return ab < ba;
-	});
+		if(needed.count(r->head.name))
+		{
+			if(opts.trace)
+				opts.trace->unstratifiable(r);
+			return rel_ptr(0);
+		}
+	}
 
-	auto idx = partition.begin();
 	std::map<std::string,rel_ptr> rels(edb);
+	std::unique_ptr<thread_pool> pool(opts.threads > 1 ? new thread_pool(opts.threads) : 0);
 
-	while(idx != partition.end())
-	{
-		auto idx_end = std::find_if(idx,partition.end(),[&](const std::string &s) { return !mutual_rec(idb,*idx,s); });
-		std::map<std::string,rel_ptr> deltas;
-		std::set<rule_ptr> simple, recursive;
-		const unsigned int pos = std::distance(partition.begin(),idx);
-
-		std::for_each(idx,idx_end,[&](const std::string &s)
-		{
-			std::for_each(idb.lower_bound(s),idb.upper_bound(s),[&](const std::pair<std::string,rule_ptr> &p)
-			{
-				bool is_recu = !std::all_of(p.second->body.begin(),p.second->body.end(),[&](const predicate &pred)
-					{ return edb.count(pred.name) > 0 || pos > std::distance(partition.begin(),std::find(partition.begin(),partition.end(),pred.name)); });
-
-				if(is_recu)
-					recursive.insert(p.second);
-				else
-					simple.insert(p.second);
-			});
-		});
+	const std::list<std::set<std::string>> strata = graph.stratify(partition);
 
-		// eval all rules w/ body predicates in edb or <idx once
-		std::cout << "one shot:" << std::endl;
-		for(rule_ptr r: simple)
-		{
-			assert(r);
-			std::cout << *r << std::endl;
+	for(const std::set<std::string> &stratum: strata)
+		if(!eval_stratum(stratum,idb,rels,opts,pool.get(),&stratum == &strata.back() ? emit : emitter()))
+			break;
 
-			std::vector<rel_ptr> plan;
-			const std::string &n = r->head.name;
+	assert(rels.count(query));
+	return rels[query];
+}
 
-			for(const predicate &p: r->body)
-				plan.push_back(rels[p.name]);
+std::string adorned(const std::string &name, const std::string &adornment)
+{
+	return adornment.find('b') == std::string::npos ? name : name + "@" + adornment;
+}
 
-			rel_ptr res = eval_rule(r,plan);
+std::string magic(const std::string &name, const std::string &adornment)
+{
+	return "magic@" + name + "@" + adornment;
+}
 
-			if(res)
-			{
-				rel_ptr old = rels.count(n) ? rels[n] : 0;
+// magic sets transformation of the rules 'query' depends upon. atoms are adorned w/
+// the bound (b) and free (f) arguments passed left-to-right through the rule bodies,
+// every adorned rule is guarded by a magic predicate holding the bindings it is called
+// with. negated and all free atoms keep their original rules. the rewritten rules and
+// the seed fact for the bindings of 'query' are added to 'out'. returns the name of the
+// adorned query predicate.
+std::string magic_sets(const predicate &query, const std::multimap<std::string,rule_ptr> &idb, std::multimap<std::string,rule_ptr> &out)
+{
+	std::list<std::pair<std::string,std::string>> todo; // predicate, adornment
+	std::set<std::pair<std::string,std::string>> done;
+	std::set<std::string> plain;
+	std::string ad;
+	std::vector<variable> seed;
+
+	// copy rules of 'name' and everything it depends upon unchanged
+	std::function<void(const std::string &)> keep = [&](const std::string &name)
+	{
+		for(const std::string &s: depends(idb,name))
+			if(plain.insert(s).second)
+				out.insert(idb.lower_bound(s),idb.upper_bound(s));
+	};
 
-				if(old)
-					old->insert(res);
-				else
-					rels.insert(std::make_pair(n,res));
-				
-				std::cout << *res << std::endl;
-			}
-		}
+	for(const variable &v: query.variables)
+	{
+		ad += v.bound ? 'b' : 'f';
+		if(v.bound)
+			seed.push_back(v);
+	}
 
-		// eval all rec rules in parallel until fixpoint is reached
-		std::cout << "recursive first:" << std::endl;
-		bool modified;
-		
-		for(rule_ptr r: recursive)
-		{
-			assert(r);
-			std::cout << *r << std::endl;
+	if(!idb.count(query.name) || ad.find('b') == std::string::npos)
+	{
+		keep(query.name);
+		return query.name;
+	}
 
-			std::vector<rel_ptr> plan;
-			const std::string &n = r->head.name;
+	out.insert(std::make_pair(magic(query.name,ad),rule_ptr(new rule(predicate(magic(query.name,ad),seed,false)))));
+	todo.push_back(std::make_pair(query.name,ad));
+	done.insert(todo.back());
 
-			for(const predicate &p: r->body)
-				plan.push_back(rels[p.name]);
+	while(!todo.empty())
+	{
+		const std::string name = todo.front().first, head_ad = todo.front().second;
 
-			rel_ptr res = eval_rule(r,plan);
+		todo.pop_front();
+		std::for_each(idb.lower_bound(name),idb.upper_bound(name),[&](const std::pair<std::string,rule_ptr> &q)
+		{
+			const rule_ptr r = q.second;
+			std::set<std::string> known;
+			std::vector<variable> guard_vars;
+			std::list<predicate> body;
+			unsigned int i = 0;
 
-			if(res)
+			while(i < head_ad.size())
 			{
-				rel_ptr d = deltas.count(n) ? deltas[n] : 0;
+				const variable &v = r->head.variables[i];
 
-				if(d)
-					d->insert(res);
-				else
-					deltas.insert(std::make_pair(n,res));
-					
-				std::cout << *res << std::endl;
+				if(head_ad[i] == 'b')
+				{
+					guard_vars.push_back(v);
+					if(!v.bound)
+						known.insert(v.name);
+				}
+				++i;
 			}
-		}
-		
-		std::cout << "recursive delta:" << std::endl;
-		do
-		{
-			modified = false;
-			std::list<std::pair<std::string,rel_ptr>> new_deltas;
-
-			for(const rule_ptr r: recursive)
-			{
-				assert(r);
-				std::cout << *r << std::endl;
 
-				std::vector<rel_ptr> plan(r->body.size(),rel_ptr(0));
-				unsigned int sub = std::pow(2,r->body.size()) - 2;	// 1: current, 0: delta
-				rel_ptr res;
+			const predicate guard(magic(name,head_ad),guard_vars,false);
+			body.push_back(guard);
 
-				do
+			for(const predicate &p: r->body)
+			{
+				if(!idb.count(p.name))
 				{
-					unsigned int pi = 0;
+					body.push_back(p);
+				}
+				else if(p.negated)
+				{
+					keep(p.name);
+					body.push_back(p);
+				}
+				else
+				{
+					std::string p_ad;
+					std::vector<variable> p_bound;
 
-					while(pi < r->body.size())
+					for(const variable &v: p.variables)
 					{
-						const std::string &pn = std::next(r->body.begin(),pi)->name;
+						bool b = v.bound || known.count(v.name);
 
-						if(sub & (1 << pi))
-						{
-							assert(rels.count(pn) && rels[pn]);
-							plan[pi] = rels[pn];
-						}
-						else
-						{
-							if(!deltas.count(pn) || !deltas[pn])
-								goto out;
+						p_ad += b ? 'b' : 'f';
+						if(b)
+							p_bound.push_back(v);
+					}
+
+					if(p_ad.find('b') == std::string::npos)
+					{
+						keep(p.name);
+					}
+					else
+					{
+						// bindings for 'p' are the guard joined w/ the positive atoms left of it
+						std::list<predicate> magic_body;
 
-							plan[pi] = deltas[pn];
-						}
+						std::copy_if(body.begin(),body.end(),std::inserter(magic_body,magic_body.end()),[](const predicate &x) { return !x.negated; });
+						out.insert(std::make_pair(magic(p.name,p_ad),rule_ptr(new rule(predicate(magic(p.name,p_ad),p_bound,false),magic_body))));
 
-						++pi;
+						if(done.insert(std::make_pair(p.name,p_ad)).second)
+							todo.push_back(std::make_pair(p.name,p_ad));
 					}
-					
-					res = eval_rule(r,plan);
-					new_deltas.push_back(std::make_pair(r->head.name,res));
-					std::cout << *res << std::endl;
 
-					out: ;
+					body.push_back(predicate(adorned(p.name,p_ad),p.variables,false));
 				}
-				while(sub--);
-			}
 
-			// merge old deltas with 'rel'
-			for(const std::pair<std::string,rel_ptr> &p: deltas)
-			{
-				if(rels.count(p.first))
-					rels[p.first]->insert(p.second);
+				if(!p.negated)
+					for(const variable &v: p.variables)
+						if(!v.bound)
+							known.insert(v.name);
 			}
-			deltas.clear();
 
-			// set new deltas, set 'modified'
-			for(const std::pair<std::string,rel_ptr> &p: new_deltas)
-			{
-				if(rels.count(p.first))
-				{
-					rel_ptr cur = rels[p.first];
-					for(const relation::row &r: p.second->rows())
-						modified |= !cur->includes(r);
-				}
+			rule_ptr nr(new rule(predicate(adorned(name,head_ad),r->head.variables,false),body));
 
-				modified |= p.second->rows().size() > 0;
-				
-				if(deltas.count(p.first))
-					deltas[p.first]->insert(p.second);
-				else
-					deltas.insert(p);
-			}
-			new_deltas.clear();
-		}
-		while(modified);
-		
-		idx = idx_end;
+			nr->constraints = r->constraints;
+			nr->join = r->join;
+			out.insert(std::make_pair(nr->head.name,nr));
+		});
 	}
 
-	assert(rels.count(query));
-	return rels[query];
+	return adorned(query.name,ad);
+}
+
+rel_ptr eval(const predicate &query, std::multimap<std::string,rule_ptr> &idb, std::map<std::string,rel_ptr> &edb, const eval_options &opts)
+{
+	std::multimap<std::string,rule_ptr> rewritten;
+	const std::string n = magic_sets(query,idb,rewritten);
+	eval_options inner(opts);
+
+	// a cached graph is one of 'idb', not of the rewritten rules
+	inner.graph = 0;
+	rel_ptr res = eval(n,rewritten,edb,inner);
+
+	if(!res)
+		return res;
+
+	// the adorned relation may hold answers for bindings of recursive calls too
+	rel_ptr ret(new relation(query.variables.size()));
+	for(unsigned int i: res->find(query.variables))
+		ret->insert(res->rows()[i]);
+
+	return ret;
 }
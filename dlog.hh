@@ -17,6 +17,10 @@
 #include <boost/variant.hpp>
 #include <cstring>
 #include <memory>
+#include <array>
+#include <mutex>
+#include <atomic>
+#include <chrono>
 
 struct variable;
 class relation;
@@ -39,8 +43,9 @@ namespace std
 				return hash<unsigned int>()(::boost::get<unsigned int>(v));
 			else if(v.type() == typeid(string))
 				return hash<string>()(::boost::get<string>(v));
-			else
-				assert(false);
+
+			assert(false);
+			return 0;
     }
 	};	
 	
@@ -61,34 +66,189 @@ bool operator<=(const variant &a, const variant &b);
 bool operator>(const variant &a, const variant &b);
 bool operator>=(const variant &a, const variant &b);
 
+// Values are dictionary encoded into 32 bit ids. Unsigned integers below 2^31 are
+// stored verbatim, strings and larger integers are interned into the global symbol
+// table and referenced by their index with the msb set.
+typedef unsigned int value;
+
+// Interned values are append only. lookup() and less() don't lock, chunk k holds 64 << k
+// symbols and never moves. An id is published after its symbol is written.
+class symbol_table
+{
+public:
+	symbol_table(void);
+
+	value intern(const variant &v);
+	variant lookup(value v) const;
+	bool less(value a, value b) const;	// both interned, w/o copying them
+	size_t size(void) const;
+
+private:
+	const variant &at(value v) const;
+
+	std::unique_ptr<variant[]> m_chunks[26];
+	std::atomic<size_t> m_size;
+	std::unordered_map<variant,value> m_ids;
+	std::mutex m_lock;	// loaders intern from several threads
+};
+
+symbol_table &symbols(void);
+value encode(const variant &v);
+variant decode(value v);
+
+// order of the decoded values (numbers before strings), w/o decoding small numbers
+bool value_less(value a, value b);
+
+// range of values in value_less order, either end may be open
+struct interval
+{
+	interval(void);
+
+	void lower(value v, bool strict);	// tightens the bounds
+	void upper(value v, bool strict);
+	bool contains(value v) const;
+
+	bool has_lo, lo_strict, has_hi, hi_strict;
+	value lo, hi;
+};
+
+// Relations are stored column-wise, one contiguous array of values per column. The
+// arity (at most 64) is fixed by the constructor or, if not given, by the first insert().
+// Lookups are answered by composite indices that are built on first use for each set of
+// bound columns passed to find(). A relation may also be a view over external columns
+// (e.g. a mapped snapshot), which are copied on the first modification.
 class relation
 {
 public:
-	typedef std::vector<variant> row;
-	
-	const std::vector<row> &rows(void) const;
-	std::set<unsigned int> *find(const std::vector<variable> &b) const;
+	typedef std::vector<value> row;
+
+	// row adapter over the columns of a relation
+	class row_view
+	{
+	public:
+		row_view(const relation *r, unsigned int i);
+
+		value operator[](unsigned int col) const;
+		value at(unsigned int col) const;
+		size_t size(void) const;
+		operator row(void) const;
+
+		const relation *rel;
+		unsigned int index;
+	};
+
+	class iterator
+	{
+	public:
+		typedef std::forward_iterator_tag iterator_category;
+		typedef row_view value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef const row_view *pointer;
+		typedef const row_view &reference;
+
+		iterator(const relation *r, unsigned int i);
+
+		const row_view &operator*(void) const;
+		const row_view *operator->(void) const;
+		iterator &operator++(void);
+		iterator operator++(int);
+		bool operator==(const iterator &i) const;
+		bool operator!=(const iterator &i) const;
+
+	private:
+		row_view m_cur;
+	};
+
+	class row_range
+	{
+	public:
+		row_range(const relation *r);
+
+		iterator begin(void) const;
+		iterator end(void) const;
+		size_t size(void) const;
+		bool empty(void) const;
+		row_view operator[](unsigned int i) const;
+
+	private:
+		const relation *m_relation;
+	};
+
+	relation(void);
+	relation(unsigned int arity);
+	relation(unsigned int arity, size_t rows, const std::vector<const value *> &cols, std::shared_ptr<const void> owner);
+
+	row_range rows(void) const;
+	unsigned int arity(void) const;
+	size_t distinct(unsigned long long mask) const;
+	const value *column(unsigned int col) const;
+	std::vector<unsigned int> find(const std::vector<variable> &b) const;
+	void find(const std::vector<variable> &b, std::vector<unsigned int> &ret) const;
+	void range(unsigned int col, const interval &iv, std::vector<unsigned int> &ret) const;
 	bool includes(const relation::row &r) const;
+	bool includes(const relation::row_view &r) const;
 
 	bool insert(const row &r);
+	bool insert(const row_view &r);
 	bool insert(std::shared_ptr<relation> r);
-	void reject(std::function<bool(const row &)> f);
+
+	// fixed size rows w/o heap allocation
+	template<size_t N> bool insert(const std::array<value,N> &r) { return insert(r.data(),N); }
+	template<size_t N> bool includes(const std::array<value,N> &r) const { return includes(r.data(),N); }
+	bool insert(const value *r, unsigned int n);
+	bool includes(const value *r, unsigned int n) const;
+	bool remove(const row &r);
+	void reject(std::function<bool(const row_view &)> f);
+
+	void build_index(unsigned long long mask) const;
+	std::set<unsigned long long> indices(void) const; // masks of the built indices
 
 private:
-	std::vector<row> m_rows;
-	mutable std::vector<std::unordered_multimap<variant,unsigned int>> m_indices;
+	bool m_fixed;
+	unsigned int m_arity;
+	size_t m_size;
+	std::vector<std::vector<value>> m_columns;
+	std::vector<const value *> m_data;	// start of each column, in m_columns or m_external
+	std::shared_ptr<const void> m_external;	// keeps external columns alive
+	mutable std::unordered_multimap<size_t,unsigned int> m_tuples; // tuple hash -> row, for duplicate elimination
+	mutable std::atomic<bool> m_hashed;	// m_tuples is complete
+
+	// composite index over the columns set in the mask, maps the hash of these columns to the rows
+	typedef std::unordered_map<size_t,std::vector<unsigned int>> index;
+	mutable std::unordered_map<unsigned long long,index> m_indices; // column mask -> index
+	mutable std::unordered_map<unsigned int,std::vector<unsigned int>> m_ordered; // column -> rows sorted by it. rows appended since are merged in on next use
+	mutable std::mutex m_index_lock;
 
-	void index(void) const;
+	template<typename R> size_t hash_key(const R &r, unsigned long long mask) const;
+	template<typename R> size_t hash_row(const R &r) const;
+	template<typename R> bool matches(unsigned int i, const R &r, unsigned long long mask) const;
+	template<typename R> bool lookup(const R &r, size_t h) const;
+	template<typename R> bool append(const R &r);
+	void fix_arity(unsigned int a);
+	void own(void);
+	void sync(void);
+	void hash_rows(void) const;
+	const index &index_for(unsigned long long mask) const;
+	const std::vector<unsigned int> &ordered_for(unsigned int col) const;
 };
 typedef std::shared_ptr<relation> rel_ptr;
 
 struct variable
 {
-	variable(bool b, variant v, std::string n);
+	// aggregates of a head column over the rows agreeing on the other columns. min and max
+	// keep the best value and may be recursive, count and sum see each distinct binding of
+	// the body variables once.
+	enum Aggregate
+	{
+		None, Min, Max, Count, Sum,
+	};
+
+	variable(bool b, variant v, std::string n, Aggregate a = None);
 
 	bool bound;
-	variant instantiation;
+	value instantiation;
 	std::string name;
+	Aggregate aggregate;	// only in rule heads
 };
 
 bool operator==(const variable &a, const variable &b);
@@ -128,6 +288,10 @@ struct constraint
 
 	constraint(Type t, variable a, variable b);
 	bool operator()(const std::unordered_map<std::string,unsigned int> &binding, const relation::row &r) const;
+	bool operator()(const std::unordered_map<std::string,unsigned int> &binding, const relation::row_view &r) const;
+
+	static Type flip(Type t);			// a t b <=> b flip(t) a
+	static bool holds(Type t, value a, value b);
 
 	Type type;
 	variable operand1, operand2;
@@ -137,6 +301,14 @@ std::ostream &operator<<(std::ostream &os, const constraint &c);
 
 struct rule
 {
+	// algorithm used to join the non-negated body atoms
+	enum Join
+	{
+		Default,		// use eval_options::join
+		Pairwise,		// left-deep chain of binary joins
+		Leapfrog,		// worst-case optimal leapfrog triejoin
+	};
+
 	rule(predicate h);
 	rule(predicate h, std::initializer_list<predicate> &lst);
 	rule(predicate h, const std::list<predicate> &plst);
@@ -144,6 +316,7 @@ struct rule
 	predicate head;
 	std::list<predicate> body;
 	std::list<constraint> constraints;
+	Join join;
 };
 typedef std::shared_ptr<rule> rule_ptr;
 
@@ -152,9 +325,9 @@ std::ostream &operator<<(std::ostream &os, const rule &r);
 template<typename... Args>
 void insert(rel_ptr rel, Args&&... args)
 {
-	assert(rel->rows().empty() || rel->rows().begin()->size() == sizeof...(args));
+	assert(rel->rows().empty() || rel->arity() == sizeof...(args));
 	
-	std::vector<variant> nr({variant(args)...});
+	std::array<value,sizeof...(args)> nr = {{encode(variant(args))...}};
 	rel->insert(nr);
 }
 
@@ -168,21 +341,166 @@ rel_ptr find(rel_ptr rel, Args&&... args)
 	assert(rel->rows().empty() || rel->rows().begin()->size() == sizeof...(args));
 	
 	std::vector<variable> nr({find_helper(args)...});
-	std::set<unsigned int> *idx = rel->find(nr);
 	rel_ptr ret(new relation());
 
-	if(idx)
-	{
-		auto i = idx->begin();
-		while(i != idx->end())
-			ret->insert(rel->rows()[*i++]);
-		delete idx;
-	}
+	for(unsigned int i: rel->find(nr))
+		ret->insert(rel->rows()[i]);
 
 	return ret;
 }*/
 
+// Counters of one eval_rule() call, collected only if a tracer is set.
+struct rule_stats
+{
+	rule_stats(void);
+
+	double seconds;		// wall time
+	size_t produced;	// result tuples, including known ones
+	size_t probes;		// relation::find() calls
+	size_t peak;			// largest intermediate join result
+};
+
+// Hooks called during evaluation. All default to doing nothing, evaluation w/o a tracer
+// only tests eval_options::trace. With eval_options::threads > 1 rule_start() and
+// rule_finish() are called from worker threads.
+class tracer
+{
+public:
+	virtual ~tracer(void);
+
+	virtual void skipped(const std::string &pred);					// not needed for the query
+	virtual void unsafe(const rule_ptr r);									// query fails, or the rule is ignored by database
+	virtual void unstratifiable(const rule_ptr r);					// part of a cycle w/ negation or aggregation, query fails
+	virtual void stratum(const std::set<std::string> &preds);		// before each stratum
+	virtual void stratum_finish(const std::set<std::string> &preds);
+	virtual void iteration(unsigned int n);											// 0 for the non-recursive rules
+	virtual void rule_start(const rule_ptr r);
+	virtual void rule_finish(const rule_ptr r, const rel_ptr res, const rule_stats &st);	// res is 0 if nothing matched
+	virtual void derived(const rule_ptr r, size_t rows);				// tuples of the last result not known before
+	virtual void delta(const std::string &pred, size_t rows);		// new tuples after an iteration
+};
+
+// Prints every rule and result to a stream. Slow, for debugging only.
+class stream_tracer : public tracer
+{
+public:
+	stream_tracer(std::ostream &os);
+
+	virtual void skipped(const std::string &pred);
+	virtual void unsafe(const rule_ptr r);
+	virtual void unstratifiable(const rule_ptr r);
+	virtual void stratum(const std::set<std::string> &preds);
+	virtual void iteration(unsigned int n);
+	virtual void rule_finish(const rule_ptr r, const rel_ptr res, const rule_stats &st);
+	virtual void delta(const std::string &pred, size_t rows);
+
+private:
+	std::ostream &m_stream;
+	std::mutex m_lock;
+};
+
+// Collects rule_stats per rule and stratum. operator<< prints an EXPLAIN ANALYZE like
+// report with the most expensive rules of each stratum first.
+class profiler : public tracer
+{
+public:
+	struct rule_entry
+	{
+		rule_ptr rule;
+		unsigned int calls;
+		double seconds;
+		size_t produced, fresh, probes, peak;
+	};
+
+	struct stratum_entry
+	{
+		std::set<std::string> preds;
+		double seconds;
+		unsigned int iterations;
+		std::vector<rule_entry> rules;
+	};
+
+	virtual void stratum(const std::set<std::string> &preds);
+	virtual void stratum_finish(const std::set<std::string> &preds);
+	virtual void iteration(unsigned int n);
+	virtual void rule_finish(const rule_ptr r, const rel_ptr res, const rule_stats &st);
+	virtual void derived(const rule_ptr r, size_t rows);
+
+	const std::list<stratum_entry> &report(void) const;
+
+private:
+	std::list<stratum_entry> m_strata;
+	std::map<rule_ptr,unsigned int> m_index;	// into m_strata.back().rules
+	std::chrono::steady_clock::time_point m_start;
+	std::mutex m_lock;
+
+	rule_entry &entry(const rule_ptr r);
+};
+
+std::ostream &operator<<(std::ostream &os, const profiler &p);
+
+// Predicate dependency graph of an idb, built once. Strata are the strongly connected
+// components (Tarjan), numbered so that a predicate's dependencies come first.
+class dependency_graph
+{
+public:
+	dependency_graph(void);
+	dependency_graph(const std::multimap<std::string,rule_ptr> &idb);
+
+	// all predicates 'query' depends upon, including itself
+	std::set<std::string> depends(const std::string &query) const;
+	// 'preds' grouped by component, in topological order
+	std::list<std::set<std::string>> stratify(const std::set<std::string> &preds) const;
+	// rules negating, counting or summing a predicate of their own component. the idb isn't
+	// stratifiable if non-empty
+	const std::vector<rule_ptr> &cycles(void) const;
+
+private:
+	std::unordered_map<std::string,unsigned int> m_ids;
+	std::vector<std::string> m_names;
+	std::vector<std::vector<unsigned int>> m_edges;	// head -> body predicates
+	std::vector<unsigned int> m_component;
+	std::vector<rule_ptr> m_cycles;
+
+	unsigned int id(const std::string &name);
+};
+
+struct eval_options
+{
+	eval_options(void);
+
+	rule::Join join;	// join algorithm for rules w/ rule::Default
+	unsigned int threads;	// rules of a stratum are evaluated in parallel if > 1
+	size_t partition;			// w/ threads > 1, joins w/ at least this many outer rows are split across threads
+	tracer *trace;				// not owned, may be 0
+	const dependency_graph *graph;	// not owned, may be 0. must be built from the idb passed to eval()
+};
+
+class thread_pool;
+
+// receives the tuples of a predicate new since the last call. returning false stops evaluation.
+typedef std::function<bool(const std::string &pred, const relation &fresh)> emitter;
+
+// building blocks of eval(), shared w/ database
+bool is_safe(rule_ptr r);
+bool is_recursive(const rule_ptr r, const std::set<std::string> &stratum);
+unsigned int aggregate_column(const predicate &head); // head.variables.size() w/o aggregate
+std::set<std::string> depends(const std::multimap<std::string,rule_ptr> &idb, std::string query);
+std::list<std::set<std::string>> stratify(const std::multimap<std::string,rule_ptr> &idb, const std::set<std::string> &preds);
+std::vector<unsigned int> plan_joins(const rule_ptr r, const std::vector<rel_ptr> &relations);
+rel_ptr eval_rule(const rule_ptr r, const std::vector<rel_ptr> &relations, const eval_options &opts, thread_pool *pool);
+void eval_rules(const std::vector<rule_ptr> &tasks, const std::vector<std::vector<rel_ptr>> &plans, std::vector<rel_ptr> &results, const eval_options &opts, thread_pool *pool);
+// returns false if 'emit' stopped evaluation, the relations of 'stratum' are incomplete then
+bool eval_stratum(const std::set<std::string> &stratum, const std::multimap<std::string,rule_ptr> &idb, std::map<std::string,rel_ptr> &rels, const eval_options &opts, thread_pool *pool, const emitter &emit = emitter());
+
+// semi-naive iteration of the 'recursive' rules of 'stratum', starting w/ 'deltas' (tuples already in 'rels').
+// if 'old' is null, atoms left of the delta atom read the full relation. new tuples are also added to 'added'
+// and passed to 'emit' after each iteration.
+bool fixpoint(const std::set<std::string> &stratum, const std::vector<rule_ptr> &recursive, std::map<std::string,rel_ptr> &rels, std::map<std::string,rel_ptr> &deltas, std::map<std::string,rel_ptr> *old, std::map<std::string,rel_ptr> *added, const eval_options &opts, thread_pool *pool, const emitter &emit = emitter());
+
 std::ostream &operator<<(std::ostream &os, const relation &a);
-rel_ptr eval(std::string query, std::multimap<std::string,rule_ptr> &in, std::map<std::string,rel_ptr> &extensional);
+rel_ptr eval(std::string query, std::multimap<std::string,rule_ptr> &in, std::map<std::string,rel_ptr> &extensional, const eval_options &opts = eval_options());
+rel_ptr eval(std::string query, std::multimap<std::string,rule_ptr> &in, std::map<std::string,rel_ptr> &extensional, const eval_options &opts, const emitter &emit);
+rel_ptr eval(const predicate &query, std::multimap<std::string,rule_ptr> &in, std::map<std::string,rel_ptr> &extensional, const eval_options &opts = eval_options());
 
 #endif
@@ -50,12 +50,41 @@ parse_h operator<<(parse_i lhs, parse_i rhs)
 	return parse_h(lhs,rhs);
 }
 
+rel_ptr eval(const parse_i &query, std::multimap<std::string,rule_ptr> &idb, std::map<std::string,rel_ptr> &edb, const eval_options &opts)
+{
+	return eval(predicate(query.parent.name,query.variables,false),idb,edb,opts);
+}
+
 parse_i operator!(parse_i i)
 {
 	i.negated = !i.negated;
 	return i;
 }
 
+variable agg::min(variable v)
+{
+	v.aggregate = variable::Min;
+	return v;
+}
+
+variable agg::max(variable v)
+{
+	v.aggregate = variable::Max;
+	return v;
+}
+
+variable agg::count(variable v)
+{
+	v.aggregate = variable::Count;
+	return v;
+}
+
+variable agg::sum(variable v)
+{
+	v.aggregate = variable::Sum;
+	return v;
+}
+
 parse_c operator<(variant a, variable b)
 {
 	return parse_c(constraint(constraint::Less,variable(true,a,""),b));
@@ -98,6 +98,17 @@ parse_c operator>=(variant a, variable b);
 parse_c operator>=(variable a, variable b);
 parse_c operator>=(variable a, variant b);
 
+rel_ptr eval(const parse_i &query, std::multimap<std::string,rule_ptr> &idb, std::map<std::string,rel_ptr> &edb, const eval_options &opts = eval_options());
+
+// aggregated head columns, e.g. dist(X,Y,agg::min(D))
+namespace agg
+{
+	variable min(variable v);
+	variable max(variable v);
+	variable count(variable v);
+	variable sum(variable v);
+}
+
 parse_i operator!(parse_i i);
 parse_h operator,(parse_h h, parse_i i);
 parse_h operator,(parse_h h, parse_c c);
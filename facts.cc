@@ -0,0 +1,216 @@
+#include <queue>
+#include <thread>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "facts.hh"
+#include "pool.hh"
+
+load_options::load_options(void)
+: delimiter('\t'), threads(std::max(std::thread::hardware_concurrency(),1u)), chunk(8 << 20)
+{
+	return;
+}
+
+// tuples of one chunk, row major
+struct chunk
+{
+	chunk(void) : begin(0), end(0), arity(0), bad(false) {}
+
+	const char *begin, *end;
+	unsigned int arity;
+	bool bad;
+	std::vector<value> data;
+	std::vector<unsigned int> order; // sorted, distinct rows
+};
+
+static value field(const char *b, const char *e, std::unordered_map<std::string,value> &cache)
+{
+	const char *p = b;
+	unsigned long long n = 0;
+
+	while(p != e && *p >= '0' && *p <= '9' && n <= 0xffffffffull)
+		n = n * 10 + (*p++ - '0');
+
+	if(p == e && b != e && n <= 0xffffffffull)
+		return encode(variant(static_cast<unsigned int>(n)));
+
+	// strings are looked up in a per thread cache before taking the symbol table lock
+	std::string s(b,e);
+	auto i = cache.find(s);
+
+	if(i != cache.end())
+		return i->second;
+
+	const value v = encode(variant(s));
+	cache.insert(std::make_pair(s,v));
+	return v;
+}
+
+static void parse(chunk &c, char delim)
+{
+	std::unordered_map<std::string,value> cache;
+	const char *p = c.begin;
+
+	while(p < c.end)
+	{
+		const char *eol = std::find(p,c.end,'\n'), *line_end = eol;
+		unsigned int fields = 0;
+
+		if(line_end > p && line_end[-1] == '\r')
+			--line_end;
+
+		if(line_end > p)
+		{
+			while(true)
+			{
+				const char *d = std::find(p,line_end,delim);
+
+				c.data.push_back(field(p,d,cache));
+				++fields;
+				if(d == line_end)
+					break;
+				p = d + 1;
+			}
+
+			if(!c.arity)
+				c.arity = fields;
+			c.bad |= fields != c.arity;
+		}
+
+		p = eol + 1;
+	}
+
+	if(c.bad || !c.arity)
+		return;
+
+	// sort and deduplicate the rows of this chunk
+	const unsigned int a = c.arity;
+	const std::vector<value> &d = c.data;
+	auto less = [&](unsigned int x, unsigned int y) { return std::lexicographical_compare(&d[x * a],&d[x * a] + a,&d[y * a],&d[y * a] + a); };
+	auto equal = [&](unsigned int x, unsigned int y) { return std::equal(&d[x * a],&d[x * a] + a,&d[y * a]); };
+
+	c.order.resize(c.data.size() / a);
+	for(unsigned int i = 0; i < c.order.size(); ++i)
+		c.order[i] = i;
+
+	std::sort(c.order.begin(),c.order.end(),less);
+	c.order.erase(std::unique(c.order.begin(),c.order.end(),equal),c.order.end());
+}
+
+rel_ptr load_facts(const std::string &path, const load_options &opts)
+{
+	const int fd = open(path.c_str(),O_RDONLY);
+	struct stat st;
+
+	if(fd < 0)
+		return rel_ptr(0);
+
+	if(fstat(fd,&st))
+	{
+		close(fd);
+		return rel_ptr(0);
+	}
+
+	if(!st.st_size)
+	{
+		close(fd);
+		return rel_ptr(new relation());
+	}
+
+	void *m = mmap(0,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+	close(fd);
+
+	if(m == MAP_FAILED)
+		return rel_ptr(0);
+
+	// split at line boundaries
+	const char *base = static_cast<const char *>(m), *end = base + st.st_size, *p = base;
+	std::vector<chunk> chunks;
+
+	while(p < end)
+	{
+		const char *e = p + std::min<size_t>(std::max<size_t>(opts.chunk,1),end - p);
+
+		e = std::find(e,end,'\n');
+		if(e != end)
+			++e;
+
+		chunks.push_back(chunk());
+		chunks.back().begin = p;
+		chunks.back().end = e;
+		p = e;
+	}
+
+	if(opts.threads > 1 && chunks.size() > 1)
+	{
+		thread_pool pool(std::min<size_t>(opts.threads,chunks.size()));
+		pool.run(chunks.size(),[&](unsigned int i) { parse(chunks[i],opts.delimiter); });
+	}
+	else
+		for(chunk &c: chunks)
+			parse(c,opts.delimiter);
+
+	munmap(m,st.st_size);
+
+	// all chunks must agree on the arity
+	unsigned int arity = 0;
+	size_t upper = 0;
+
+	for(const chunk &c: chunks)
+	{
+		if(c.bad || (c.arity && arity && c.arity != arity))
+			return rel_ptr(0);
+		arity = std::max(arity,c.arity);
+		upper += c.order.size();
+	}
+
+	if(!arity)
+		return rel_ptr(new relation());
+	if(arity > 64)
+		return rel_ptr(0);
+
+	// k-way merge of the sorted chunks, dropping duplicates across chunks
+	typedef std::pair<unsigned int,size_t> cursor; // chunk, position in its order
+	auto row = [&](const cursor &c) { const chunk &k = chunks[c.first]; return &k.data[k.order[c.second] * arity]; };
+	auto greater = [&](const cursor &a, const cursor &b) { return std::lexicographical_compare(row(b),row(b) + arity,row(a),row(a) + arity); };
+	std::priority_queue<cursor,std::vector<cursor>,decltype(greater)> heap(greater);
+	std::shared_ptr<std::vector<value>> cols(new std::vector<value>());
+	std::vector<value *> out(arity);
+	size_t rows = 0;
+
+	for(unsigned int i = 0; i < chunks.size(); ++i)
+		if(!chunks[i].order.empty())
+			heap.push(cursor(i,0));
+
+	cols->resize(upper * arity);
+	for(unsigned int col = 0; col < arity; ++col)
+		out[col] = cols->data() + col * upper;
+
+	while(!heap.empty())
+	{
+		const cursor c = heap.top();
+		const value *r = row(c);
+		unsigned int col;
+
+		bool dup = rows > 0;
+
+		heap.pop();
+		for(col = 0; dup && col < arity; ++col)
+			dup = out[col][rows - 1] == r[col];
+
+		if(!dup)
+		{
+			for(col = 0; col < arity; ++col)
+				out[col][rows] = r[col];
+			++rows;
+		}
+
+		if(c.second + 1 < chunks[c.first].order.size())
+			heap.push(cursor(c.first,c.second + 1));
+	}
+
+	return rel_ptr(new relation(arity,rows,std::vector<const value *>(out.begin(),out.end()),cols));
+}
@@ -0,0 +1,23 @@
+#ifndef FACTS_HH
+#define FACTS_HH
+
+#include "dlog.hh"
+
+struct load_options
+{
+	load_options(void);
+
+	char delimiter;				// '\t' for Souffle style .facts, ',' for CSV
+	unsigned int threads;	// parser threads
+	size_t chunk;					// bytes per parser job
+};
+
+// Reads a delimited fact file into a new relation, one tuple per line. Fields of
+// decimal digits that fit 32 bits are numbers, everything else is a string. The file
+// is split into chunks at line boundaries that are parsed, interned, sorted and
+// deduplicated in parallel, then merged into the columns of the result in one pass.
+// Indices and the duplicate table are built on first use. Returns 0 if the file can't
+// be read or its lines differ in the number of fields.
+rel_ptr load_facts(const std::string &path, const load_options &opts = load_options());
+
+#endif
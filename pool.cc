@@ -0,0 +1,68 @@
+#include <cassert>
+
+#include "pool.hh"
+
+thread_pool::thread_pool(unsigned int n)
+: m_next(0), m_count(0), m_finished(0), m_stop(false)
+{
+	assert(n > 0);
+
+	while(m_workers.size() < n)
+		m_workers.push_back(std::thread(&thread_pool::work,this));
+}
+
+thread_pool::~thread_pool(void)
+{
+	{
+		std::lock_guard<std::mutex> guard(m_mutex);
+		m_stop = true;
+	}
+
+	m_wake.notify_all();
+	for(std::thread &t: m_workers)
+		t.join();
+}
+
+void thread_pool::run(unsigned int n, std::function<void(unsigned int)> f)
+{
+	std::unique_lock<std::mutex> guard(m_mutex);
+
+	assert(m_next == m_count);
+	m_job = f;
+	m_next = 0;
+	m_finished = 0;
+	m_count = n;
+
+	m_wake.notify_all();
+	m_done.wait(guard,[&](void) { return m_finished == m_count; });
+
+	m_next = m_count = m_finished = 0;
+	m_job = nullptr;
+}
+
+unsigned int thread_pool::size(void) const
+{
+	return m_workers.size();
+}
+
+void thread_pool::work(void)
+{
+	std::unique_lock<std::mutex> guard(m_mutex);
+
+	while(true)
+	{
+		m_wake.wait(guard,[&](void) { return m_stop || m_next < m_count; });
+
+		if(m_stop)
+			return;
+
+		unsigned int i = m_next++;
+
+		guard.unlock();
+		m_job(i);
+		guard.lock();
+
+		if(++m_finished == m_count)
+			m_done.notify_all();
+	}
+}
@@ -0,0 +1,32 @@
+#ifndef POOL_HH
+#define POOL_HH
+
+#include <vector>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// fixed set of worker threads running batches of independent jobs
+class thread_pool
+{
+public:
+	thread_pool(unsigned int n);
+	~thread_pool(void);
+
+	// calls f(0) ... f(n - 1) on the workers and waits until all calls returned
+	void run(unsigned int n, std::function<void(unsigned int)> f);
+	unsigned int size(void) const;
+
+private:
+	std::vector<std::thread> m_workers;
+	std::mutex m_mutex;
+	std::condition_variable m_wake, m_done;
+	std::function<void(unsigned int)> m_job;
+	unsigned int m_next, m_count, m_finished;
+	bool m_stop;
+
+	void work(void);
+};
+
+#endif
@@ -0,0 +1,265 @@
+#include <fstream>
+#include <algorithm>
+#include <iterator>
+#include <cstdint>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "snapshot.hh"
+
+static const char magic[8] = {'D','L','O','G','S','N','A','P'};
+static const uint32_t version = 2;
+
+struct header
+{
+	char magic[8];
+	uint32_t version, arity;
+	uint64_t rows, symbols, masks, columns; // 'columns' is the file offset of the first column
+};
+
+// file mapping, unmapped w/ the last relation using it
+struct mapping
+{
+	mapping(void *p, size_t l) : ptr(p), len(l) {}
+	~mapping(void) { munmap(ptr,len); }
+
+	void *ptr;
+	size_t len;
+};
+
+static void pad(std::ofstream &os)
+{
+	while(os.tellp() % 8)
+		os.put(0);
+}
+
+bool save_snapshot(const relation &rel, const std::string &path)
+{
+	std::ofstream os(path,std::ios::binary | std::ios::trunc);
+	const std::set<unsigned long long> masks = rel.indices();
+	const size_t rows = rel.rows().size();
+	std::vector<value> used; // interned ids of the relation, ascending
+	header hdr;
+
+	if(!os)
+		return false;
+
+	// only the symbols the relation uses are written, numbered densely
+	for(unsigned int col = 0; col < rel.arity(); ++col)
+		std::copy_if(rel.column(col),rel.column(col) + rows,std::back_inserter(used),[](value v) { return v & 0x80000000; });
+	std::sort(used.begin(),used.end());
+	used.erase(std::unique(used.begin(),used.end()),used.end());
+
+	std::unordered_map<value,uint32_t> ids;	// process -> file id
+	for(size_t i = 0; i < used.size(); ++i)
+		ids.insert(std::make_pair(used[i],i));
+
+	// columns w/ file ids and the highest one + 1 per column
+	std::vector<std::vector<value>> cols(rel.arity(),std::vector<value>(rows));
+	std::vector<uint32_t> limits(rel.arity(),0);
+
+	for(unsigned int col = 0; col < rel.arity(); ++col)
+	{
+		const value *src = rel.column(col);
+
+		for(size_t r = 0; r < rows; ++r)
+		{
+			if(src[r] & 0x80000000)
+			{
+				const uint32_t id = ids[src[r]];
+
+				cols[col][r] = id | 0x80000000;
+				limits[col] = std::max(limits[col],id + 1);
+			}
+			else
+				cols[col][r] = src[r];
+		}
+	}
+
+	std::copy(magic,magic + 8,hdr.magic);
+	hdr.version = version;
+	hdr.arity = rel.arity();
+	hdr.rows = rows;
+	hdr.symbols = used.size();
+	hdr.masks = masks.size();
+	hdr.columns = 0;
+	os.write(reinterpret_cast<const char *>(&hdr),sizeof(hdr));
+
+	for(uint64_t m: masks)
+		os.write(reinterpret_cast<const char *>(&m),sizeof(m));
+
+	for(uint32_t l: limits)
+		os.write(reinterpret_cast<const char *>(&l),sizeof(l));
+
+	for(value id: used)
+	{
+		const variant v = symbols().lookup(id);
+
+		if(v.type() == typeid(unsigned int))
+		{
+			const uint32_t u = boost::get<unsigned int>(v);
+
+			os.put(0);
+			os.write(reinterpret_cast<const char *>(&u),sizeof(u));
+		}
+		else
+		{
+			const std::string &s = boost::get<std::string>(v);
+			const uint32_t l = s.size();
+
+			os.put(1);
+			os.write(reinterpret_cast<const char *>(&l),sizeof(l));
+			os.write(s.data(),l);
+		}
+	}
+
+	pad(os);
+	hdr.columns = os.tellp();
+
+	for(unsigned int col = 0; col < rel.arity(); ++col)
+	{
+		if(rows)
+			os.write(reinterpret_cast<const char *>(cols[col].data()),rows * sizeof(value));
+		pad(os);
+	}
+
+	// patch in the column offset
+	os.seekp(0);
+	os.write(reinterpret_cast<const char *>(&hdr),sizeof(hdr));
+
+	return bool(os);
+}
+
+rel_ptr load_snapshot(const std::string &path, bool indices)
+{
+	const int fd = open(path.c_str(),O_RDONLY);
+	struct stat st;
+
+	if(fd < 0)
+		return rel_ptr(0);
+
+	if(fstat(fd,&st) || size_t(st.st_size) < sizeof(header))
+	{
+		close(fd);
+		return rel_ptr(0);
+	}
+
+	void *p = mmap(0,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+	close(fd);
+
+	if(p == MAP_FAILED)
+		return rel_ptr(0);
+
+	std::shared_ptr<mapping> map(new mapping(p,st.st_size));
+	const char *base = static_cast<const char *>(p), *end = base + st.st_size;
+	const header *hdr = reinterpret_cast<const header *>(base);
+
+	// sizes are checked by division, the products of bogus counts may overflow
+	if(!std::equal(magic,magic + 8,hdr->magic) || hdr->version != version || hdr->arity > 64 ||
+		 hdr->rows > size_t(st.st_size) / sizeof(value) || hdr->columns > size_t(st.st_size))
+		return rel_ptr(0);
+
+	const size_t col_bytes = (hdr->rows * sizeof(value) + 7) & ~size_t(7);
+	const char *q = base + sizeof(header);
+
+	if((hdr->arity && col_bytes > (size_t(st.st_size) - hdr->columns) / hdr->arity) ||
+		 hdr->masks > size_t(end - q) / sizeof(uint64_t) || hdr->symbols > 0x7fffffff)
+		return rel_ptr(0);
+
+	// masks, then symbols. 'remap' translates ids of the file into ones of this process
+	std::vector<unsigned long long> masks(hdr->masks);
+	bool identity = true;
+
+	for(unsigned long long &m: masks)
+	{
+		std::copy(q,q + sizeof(uint64_t),reinterpret_cast<char *>(&m));
+		q += sizeof(uint64_t);
+	}
+
+	// per column limit of the file ids, columns mapped in place aren't scanned
+	std::vector<uint32_t> limits(hdr->arity);
+
+	if(hdr->arity * sizeof(uint32_t) > size_t(end - q))
+		return rel_ptr(0);
+	for(uint32_t &l: limits)
+	{
+		std::copy(q,q + sizeof(uint32_t),reinterpret_cast<char *>(&l));
+		q += sizeof(uint32_t);
+		if(l > hdr->symbols)
+			return rel_ptr(0);
+	}
+
+	// each symbol takes at least 5 bytes
+	if(hdr->symbols > size_t(end - q) / 5)
+		return rel_ptr(0);
+
+	std::vector<value> remap(hdr->symbols);
+
+	for(size_t i = 0; i < hdr->symbols; ++i)
+	{
+		uint32_t u;
+
+		if(end - q < 5)
+			return rel_ptr(0);
+
+		const char tag = *q++;
+		std::copy(q,q + sizeof(u),reinterpret_cast<char *>(&u));
+		q += sizeof(u);
+
+		if(tag == 0)
+			remap[i] = symbols().intern(variant(u));
+		else
+		{
+			if(size_t(end - q) < u)
+				return rel_ptr(0);
+			remap[i] = symbols().intern(variant(std::string(q,u)));
+			q += u;
+		}
+
+		identity &= remap[i] == (i | 0x80000000);
+	}
+
+	std::vector<const value *> cols;
+	std::shared_ptr<const void> owner = map;
+
+	for(unsigned int col = 0; col < hdr->arity; ++col)
+		cols.push_back(reinterpret_cast<const value *>(base + hdr->columns + col * col_bytes));
+
+	if(!identity)
+	{
+		std::shared_ptr<std::vector<value>> copy(new std::vector<value>(hdr->arity * hdr->rows));
+
+		for(unsigned int col = 0; col < hdr->arity; ++col)
+		{
+			value *dst = copy->data() + col * hdr->rows;
+
+			for(size_t r = 0; r < hdr->rows; ++r)
+			{
+				const value v = cols[col][r];
+
+				if(!(v & 0x80000000))
+					dst[r] = v;
+				else if((v & 0x7fffffff) < limits[col])
+					dst[r] = remap[v & 0x7fffffff];
+				else
+					return rel_ptr(0);
+			}
+			cols[col] = dst;
+		}
+
+		owner = copy;
+	}
+
+	if(!hdr->arity)
+		return rel_ptr(new relation());
+
+	rel_ptr ret(new relation(hdr->arity,hdr->rows,cols,owner));
+
+	if(indices)
+		for(unsigned long long m: masks)
+			ret->build_index(m);
+
+	return ret;
+}
@@ -0,0 +1,24 @@
+#ifndef SNAPSHOT_HH
+#define SNAPSHOT_HH
+
+#include "dlog.hh"
+
+// Binary snapshots of relations. The file holds the encoded columns, the symbols used by
+// them and the masks of the indices built at the time of writing:
+//
+//   header    magic "DLOGSNAP", version, arity, rows, #symbols, #masks, column offset
+//   masks     one u64 per index
+//   limits    one u32 per column, its highest symbol id + 1
+//   symbols   per symbol a tag byte (0: unsigned int, 1: string) and a u32 value or length + bytes
+//   columns   'rows' u32 values per column, 8 byte aligned
+//
+// Symbol ids in the file are renumbered densely. load_snapshot() maps the file and returns
+// a relation reading the columns in place. Symbols are interned in order, if they don't get
+// the ids they have in the file (the symbol table wasn't empty) the columns are translated
+// into memory instead and every id is checked against the limit of its column. Composite
+// indices are node based and can't be mapped, they are rebuilt on first use or, if
+// 'indices' is set, right away.
+bool save_snapshot(const relation &rel, const std::string &path);
+rel_ptr load_snapshot(const std::string &path, bool indices = false);
+
+#endif
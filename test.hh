@@ -1,7 +1,15 @@
 #include <cppunit/extensions/HelperMacros.h>
+#include <unistd.h>
+#include <fstream>
+#include <thread>
 
 #include "dlog.hh"
 #include "dsl.hh"
+#include "database.hh"
+#include "typed.hh"
+#include "snapshot.hh"
+#include "facts.hh"
+#include "cursor.hh"
 
 class DESTest : public CppUnit::TestFixture  
 {
@@ -9,7 +17,23 @@ class DESTest : public CppUnit::TestFixture
 	CPPUNIT_TEST(testFamily);
 	CPPUNIT_TEST(testGame);
 	CPPUNIT_TEST(testMrTc);
+	CPPUNIT_TEST(testNonLinearTc);
+	CPPUNIT_TEST(testLeapfrog);
+	CPPUNIT_TEST(testJoinOrder);
+	CPPUNIT_TEST(testMagicSets);
+	CPPUNIT_TEST(testDepends);
 	CPPUNIT_TEST(testConstraints);
+	CPPUNIT_TEST(testSymbols);
+	CPPUNIT_TEST(testIncremental);
+	CPPUNIT_TEST(testDatabase);
+	CPPUNIT_TEST(testTrace);
+	CPPUNIT_TEST(testTyped);
+	CPPUNIT_TEST(testSnapshot);
+	CPPUNIT_TEST(testLoadFacts);
+	CPPUNIT_TEST(testStream);
+	CPPUNIT_TEST(testNegation);
+	CPPUNIT_TEST(testStratify);
+	CPPUNIT_TEST(testAggregates);
 	CPPUNIT_TEST_SUITE_END();
 
 public:
@@ -188,6 +212,294 @@ public:
 			CPPUNIT_ASSERT(res->includes(r));
 	}
 
+	void testNonLinearTc(void)
+	{
+		rel_ptr edge_rel(new relation());
+		unsigned int i = 1;
+
+		while(i < 6)
+		{
+			insert(edge_rel,i,i + 1);
+			++i;
+		}
+
+		parse edge("edge"), path("path");
+
+		path("X"_dl,"Y"_dl) << edge("X"_dl,"Y"_dl);
+		path("X"_dl,"Y"_dl) << path("X"_dl,"Z"_dl),path("Z"_dl,"Y"_dl);
+
+		std::map<std::string,rel_ptr> edb;
+		std::multimap<std::string,rule_ptr> idb;
+
+		std::for_each(path.rules.begin(),path.rules.end(),[&](rule_ptr r) { idb.insert(std::make_pair(r->head.name,r)); });
+		edb.insert(std::make_pair("edge",edge_rel));
+
+		rel_ptr res = eval("path",idb,edb);
+
+		CPPUNIT_ASSERT(res);
+		CPPUNIT_ASSERT(res->rows().size() == 15);
+		
+		unsigned int j;
+		for(i = 1; i < 6; ++i)
+			for(j = i + 1; j <= 6; ++j)
+			{
+				relation::row r({encode(i),encode(j)});
+				CPPUNIT_ASSERT(res->includes(r));
+			}
+
+		eval_options opts;
+
+		// rules in parallel
+		opts.threads = 2;
+		rel_ptr par = eval("path",idb,edb,opts);
+
+		CPPUNIT_ASSERT(par);
+		CPPUNIT_ASSERT(par->rows().size() == 15);
+		for(const relation::row &r: res->rows())
+			CPPUNIT_ASSERT(par->includes(r));
+
+		// partitioned joins
+		opts.threads = 4;
+		opts.partition = 1;
+		par = eval("path",idb,edb,opts);
+
+		CPPUNIT_ASSERT(par);
+		CPPUNIT_ASSERT(par->rows().size() == 15);
+		for(const relation::row &r: res->rows())
+			CPPUNIT_ASSERT(par->includes(r));
+	}
+
+	void testLeapfrog(void)
+	{
+		rel_ptr edge_rel(new relation());
+		unsigned int i, j;
+
+		for(i = 1; i <= 12; ++i)
+			for(j = 1; j <= 12; ++j)
+				if(((i * 7 + j * 3) % 5 == 0 && (i != j || i % 2)) || j == i % 12 + 1)
+					insert(edge_rel,i,j);
+
+		parse edge("edge"), tri("tri"), around("around");
+
+		tri("X"_dl,"Y"_dl,"Z"_dl) << edge("X"_dl,"Y"_dl),edge("Y"_dl,"Z"_dl),edge("Z"_dl,"X"_dl);
+		around("X"_dl) << edge(1u,"X"_dl),edge("X"_dl,"Y"_dl),edge("Y"_dl,1u),!tri("X"_dl,"X"_dl,"X"_dl);
+
+		std::map<std::string,rel_ptr> edb;
+		std::multimap<std::string,rule_ptr> idb;
+
+		std::for_each(tri.rules.begin(),tri.rules.end(),[&](rule_ptr r) { idb.insert(std::make_pair(r->head.name,r)); });
+		std::for_each(around.rules.begin(),around.rules.end(),[&](rule_ptr r) { idb.insert(std::make_pair(r->head.name,r)); });
+		edb.insert(std::make_pair("edge",edge_rel));
+
+		eval_options opts;
+		rel_ptr pw_tri = eval("tri",idb,edb,opts);
+		rel_ptr pw_around = eval("around",idb,edb,opts);
+
+		opts.join = rule::Leapfrog;
+		rel_ptr lf_tri = eval("tri",idb,edb,opts);
+		rel_ptr lf_around = eval("around",idb,edb,opts);
+
+		CPPUNIT_ASSERT(pw_tri && lf_tri && pw_around && lf_around);
+		CPPUNIT_ASSERT(pw_tri->rows().size() > 0 && pw_around->rows().size() > 0);
+		CPPUNIT_ASSERT(pw_tri->rows().size() == lf_tri->rows().size());
+		CPPUNIT_ASSERT(pw_around->rows().size() == lf_around->rows().size());
+		for(const relation::row &r: pw_tri->rows())
+			CPPUNIT_ASSERT(lf_tri->includes(r));
+		for(const relation::row &r: pw_around->rows())
+			CPPUNIT_ASSERT(lf_around->includes(r));
+
+		// per rule selection
+		tri.rules.front()->join = rule::Leapfrog;
+		rel_ptr rl_tri = eval("tri",idb,edb);
+
+		CPPUNIT_ASSERT(rl_tri && rl_tri->rows().size() == pw_tri->rows().size());
+	}
+
+	void testJoinOrder(void)
+	{
+		rel_ptr big_rel(new relation()), info_rel(new relation()), tag_rel(new relation());
+		unsigned int i;
+
+		for(i = 0; i < 1000; ++i)
+		{
+			insert(big_rel,i,i % 100);
+			insert(info_rel,i,i * 7 % 13);
+		}
+		insert(tag_rel,5u);
+		insert(tag_rel,17u);
+		insert(tag_rel,42u);
+
+		parse big("big"), info("info"), tag("tag"), q("q");
+
+		q("X"_dl,"Z"_dl) << big("X"_dl,"Y"_dl),info("X"_dl,"Z"_dl),tag("Y"_dl);
+
+		// smallest atom first, then the connected one w/ the fewest matches per probe
+		const std::vector<unsigned int> order = plan_joins(q.rules.front(),{big_rel,info_rel,tag_rel});
+
+		CPPUNIT_ASSERT(order == std::vector<unsigned int>({2,0,1}));
+		CPPUNIT_ASSERT(big_rel->indices().empty() && info_rel->indices().empty());
+
+		std::map<std::string,rel_ptr> edb;
+		std::multimap<std::string,rule_ptr> idb;
+
+		idb.insert(std::make_pair("q",q.rules.front()));
+		edb.insert(std::make_pair("big",big_rel));
+		edb.insert(std::make_pair("info",info_rel));
+		edb.insert(std::make_pair("tag",tag_rel));
+
+		for(rule::Join j: {rule::Pairwise,rule::Leapfrog})
+		{
+			eval_options opts;
+			opts.join = j;
+
+			rel_ptr res = eval("q",idb,edb,opts);
+
+			CPPUNIT_ASSERT(res && res->rows().size() == 30);
+			for(i = 0; i < 1000; ++i)
+				CPPUNIT_ASSERT(res->includes(relation::row({i,i * 7 % 13})) == (i % 100 == 5 || i % 100 == 17 || i % 100 == 42));
+		}
+
+		// only the probed columns got indices
+		CPPUNIT_ASSERT(big_rel->indices() == std::set<unsigned long long>({2}));
+	}
+
+	void testDepends(void)
+	{
+		struct skips : public tracer
+		{
+			virtual void skipped(const std::string &pred) { preds.insert(pred); }
+			virtual void unsafe(const rule_ptr r) { rejected.insert(r->head.name); }
+			virtual void unstratifiable(const rule_ptr r) { rejected.insert(r->head.name); }
+			std::set<std::string> preds, rejected;
+		};
+
+		rel_ptr edge_rel(new relation());
+
+		insert(edge_rel,1,2);
+		insert(edge_rel,2,3);
+
+		parse edge("edge"), path("path"), bad("bad"), odd("odd"), uses("uses");
+		variable X = "X"_dl, Y = "Y"_dl, Z = "Z"_dl;
+
+		path(X,Y) << edge(X,Y);
+		path(X,Y) << path(X,Z),edge(Z,Y);
+		bad(X) << edge(X,Y),Z > 3u;				// unsafe
+		odd(X) << edge(X,Y),!odd(Y);			// not stratifiable
+		uses(X) << odd(X),bad(X);
+
+		std::map<std::string,rel_ptr> edb;
+		std::multimap<std::string,rule_ptr> idb;
+
+		for(parse *p: {&path,&bad,&odd,&uses})
+			std::for_each(p->rules.begin(),p->rules.end(),[&](rule_ptr r) { idb.insert(std::make_pair(r->head.name,r)); });
+		edb.insert(std::make_pair("edge",edge_rel));
+
+		CPPUNIT_ASSERT(depends(idb,"path") == std::set<std::string>({"path","edge"}));
+		CPPUNIT_ASSERT(depends(idb,"uses") == std::set<std::string>({"uses","odd","bad","edge"}));
+
+		// rules outside the closure of the query are neither checked nor evaluated
+		skips sk;
+		eval_options opts;
+
+		opts.trace = &sk;
+		rel_ptr res = eval("path",idb,edb,opts);
+		CPPUNIT_ASSERT(res && res->rows().size() == 3);
+		CPPUNIT_ASSERT(sk.preds == std::set<std::string>({"bad","odd","uses"}));
+
+		CPPUNIT_ASSERT(sk.rejected.empty());
+
+		// failures are reported through the tracer only
+		CPPUNIT_ASSERT(!eval("bad",idb,edb,opts));
+		CPPUNIT_ASSERT(sk.rejected == std::set<std::string>({"bad"}));
+		sk.rejected.clear();
+		CPPUNIT_ASSERT(!eval("odd",idb,edb,opts));
+		CPPUNIT_ASSERT(sk.rejected == std::set<std::string>({"odd"}));
+		CPPUNIT_ASSERT(!eval("uses",idb,edb));
+		sk.rejected.clear();
+
+		database db(idb,edb,opts);
+
+		CPPUNIT_ASSERT(sk.rejected == std::set<std::string>({"bad"}));
+		sk.rejected.clear();
+		CPPUNIT_ASSERT(!db.insert(bad.rules.front()));
+		CPPUNIT_ASSERT(sk.rejected == std::set<std::string>({"bad"}));
+	}
+
+	void testMagicSets(void)
+	{
+		rel_ptr father_rel(new relation());
+		insert(father_rel,"tom","amy");
+		insert(father_rel,"tony","carol_II");
+		insert(father_rel,"fred","carol_III");
+		insert(father_rel,"jack","fred");
+		
+		rel_ptr mother_rel(new relation());
+		insert(mother_rel,"grace","amy");
+		insert(mother_rel,"amy","fred");
+		insert(mother_rel,"carol_I","carol_II");
+		insert(mother_rel,"carol_II","carol_III");
+
+		rel_ptr move_rel(new relation());
+		insert(move_rel,1,2);
+		insert(move_rel,2,3);
+		insert(move_rel,3,4);
+		insert(move_rel,1,3);
+		insert(move_rel,1,5);
+
+		rel_ptr expected_rel(new relation());
+		insert(expected_rel,"tom","amy");
+		insert(expected_rel,"tom","carol_III");
+		insert(expected_rel,"tom","fred");
+
+		parse parent("parent"),ancestor("ancestor"),father("father"),mother("mother");
+		parse move("move"), canMove("canMove"), possible_winning("possible_winning"), winning("winning"), odd_move("odd_move");
+
+		parent("X"_dl,"Y"_dl) << father("X"_dl,"Y"_dl);
+		parent("X"_dl,"Y"_dl) << mother("X"_dl,"Y"_dl);
+		ancestor("X"_dl,"Y"_dl) << parent("X"_dl,"Y"_dl);
+		ancestor("X"_dl,"Z"_dl) << parent("X"_dl,"Y"_dl),ancestor("Y"_dl,"Z"_dl);
+
+		canMove("X"_dl) << move("X"_dl,"Y"_dl);
+		possible_winning("X"_dl) << odd_move("X"_dl,"Y"_dl),!canMove("Y"_dl);
+		winning("X"_dl) << move("X"_dl,"Y"_dl),!possible_winning("Y"_dl);
+		odd_move("X"_dl,"Y"_dl) << move("X"_dl,"Y"_dl);
+		odd_move("X"_dl,"Y"_dl) << move("X"_dl,"Z1"_dl),move("Z1"_dl,"Z2"_dl),odd_move("Z2"_dl,"Y"_dl);
+
+		std::map<std::string,rel_ptr> edb;
+		std::multimap<std::string,rule_ptr> idb;
+
+		for(parse *p: {&parent,&ancestor,&canMove,&possible_winning,&winning,&odd_move})
+			std::for_each(p->rules.begin(),p->rules.end(),[&](rule_ptr r) { idb.insert(std::make_pair(r->head.name,r)); });
+		edb.insert(std::make_pair("mother",mother_rel));
+		edb.insert(std::make_pair("father",father_rel));
+		edb.insert(std::make_pair("move",move_rel));
+
+		rel_ptr res = eval(ancestor("tom","Y"_dl),idb,edb);
+
+		CPPUNIT_ASSERT(res);
+		CPPUNIT_ASSERT(res->rows().size() == 3);
+		for(const relation::row &r: expected_rel->rows())
+			CPPUNIT_ASSERT(res->includes(r));
+
+		res = eval(ancestor("X"_dl,"fred"),idb,edb);
+		CPPUNIT_ASSERT(res && res->rows().size() == 4);
+
+		res = eval(winning(1u),idb,edb);
+		CPPUNIT_ASSERT(res && res->rows().size() == 1);
+		res = eval(winning(2u),idb,edb);
+		CPPUNIT_ASSERT(res && res->rows().empty());
+
+		// a cached graph of 'idb' doesn't know the magic predicates
+		dependency_graph graph(idb);
+		eval_options opts;
+
+		opts.graph = &graph;
+		res = eval(ancestor("tom","Y"_dl),idb,edb,opts);
+		CPPUNIT_ASSERT(res && res->rows().size() == 3);
+		res = eval(winning(1u),idb,edb,opts);
+		CPPUNIT_ASSERT(res && res->rows().size() == 1);
+	}
+
 	void testConstraints(void)
 	{
 		parse a("a"), b("b");
@@ -202,5 +514,986 @@ public:
 		for(const rule_ptr r: b.rules)
 			std::cout << *r << std::endl;
 
+		// w/ 'Y' only in the constraint the second rule is unsafe
+		CPPUNIT_ASSERT(is_safe(a.rules.front()));
+		CPPUNIT_ASSERT(!is_safe(b.rules.front()));
+
+		rel_ptr num_rel(new relation()), range_rel(new relation()), addr_rel(new relation());
+		unsigned int i = 0;
+
+		while(i < 200)
+		{
+			insert(num_rel,i);
+			insert(addr_rel,i * 7 % 1000);
+			if(i % 10 == 0)
+				insert(range_rel,i * 5,i * 5 + 25);
+			++i;
+		}
+		insert(num_rel,"abc");
+		insert(num_rel,"xyz");
+
+		parse num("num"), range("range"), addr("addr"), small("small"), word("word"), inside("inside"), split("split");
+		variable A = "A"_dl, Lo = "Lo"_dl, Hi = "Hi"_dl;
+
+		small(X) << num(X),X > 2u,X <= 10u;
+		word(X) << num(X),X > 1000u,X < std::string("m");
+		inside(A,Lo) << range(Lo,Hi),addr(A),Lo <= A,A < Hi;
+		split(X,Y) << num(X),num(Y),X < Y,Y <= 3u;
+
+		std::multimap<std::string,rule_ptr> idb;
+		std::map<std::string,rel_ptr> edb;
+
+		for(parse *p: {&small,&word,&inside,&split})
+			std::for_each(p->rules.begin(),p->rules.end(),[&](rule_ptr r) { idb.insert(std::make_pair(r->head.name,r)); });
+		edb.insert(std::make_pair("num",num_rel));
+		edb.insert(std::make_pair("range",range_rel));
+		edb.insert(std::make_pair("addr",addr_rel));
+
+		rel_ptr res = eval("small",idb,edb);
+		CPPUNIT_ASSERT(res && res->rows().size() == 8);
+		for(i = 3; i <= 10; ++i)
+			CPPUNIT_ASSERT(res->includes(relation::row({encode(i)})));
+
+		// numbers order before strings
+		res = eval("word",idb,edb);
+		CPPUNIT_ASSERT(res && res->rows().size() == 1 && res->includes(relation::row({encode(std::string("abc"))})));
+
+		res = eval("split",idb,edb);
+		CPPUNIT_ASSERT(res && res->rows().size() == 6);
+
+		// band join, compared against the cross product
+		for(const rule::Join j: {rule::Pairwise,rule::Leapfrog})
+		{
+			eval_options opts;
+			size_t expected = 0;
+
+			opts.join = j;
+			res = eval("inside",idb,edb,opts);
+			CPPUNIT_ASSERT(res);
+
+			for(const relation::row_view &rg: range_rel->rows())
+				for(const relation::row_view &ad: addr_rel->rows())
+					if(rg[0] <= ad[0] && ad[0] < rg[1])
+					{
+						CPPUNIT_ASSERT(res->includes(relation::row({ad[0],rg[0]})));
+						++expected;
+					}
+			CPPUNIT_ASSERT(res->rows().size() == expected);
+		}
+
+		// ordered indices stay valid across appends and removals
+		rel_ptr mixed(new relation());
+		std::vector<value> vals;
+		interval iv;
+
+		for(i = 0; i < 50; ++i)
+			vals.push_back(encode(i * 37 % 101));
+		for(const std::string s: {"b","a","zz","m"})
+			vals.push_back(encode(s));
+		vals.push_back(encode(0x80000007u));
+
+		auto in_range = [&](void)
+		{
+			std::vector<unsigned int> rows;
+			size_t expected = 0;
+
+			mixed->range(0,iv,rows);
+			for(unsigned int r: rows)
+				CPPUNIT_ASSERT(iv.contains(mixed->column(0)[r]));
+			for(const relation::row_view &r: mixed->rows())
+				expected += iv.contains(r[0]);
+			CPPUNIT_ASSERT(rows.size() == expected);
+		};
+
+		iv.lower(encode(20u),false);
+		iv.upper(encode(std::string("n")),true);
+		for(i = 0; i < vals.size(); ++i)
+		{
+			mixed->insert(relation::row({vals[i],i}));
+			if(i % 7 == 0)
+				in_range();
+		}
+		for(i = 0; i < vals.size(); i += 3)
+		{
+			CPPUNIT_ASSERT(mixed->remove(relation::row({vals[i],i})));
+			in_range();
+		}
+		CPPUNIT_ASSERT(value_less(encode(100u),encode(0x80000007u)) && value_less(encode(0x80000007u),encode(std::string("a"))));
+		CPPUNIT_ASSERT(!value_less(encode(std::string("a")),encode(3u)) && value_less(encode(std::string("a")),encode(std::string("b"))));
+	}
+
+	void testSymbols(void)
+	{
+		value a = encode(std::string("tom")), b = encode(std::string("amy"));
+
+		CPPUNIT_ASSERT(a != b);
+		CPPUNIT_ASSERT(a == encode(std::string("tom")));
+		CPPUNIT_ASSERT(decode(a) == variant(std::string("tom")));
+		CPPUNIT_ASSERT(encode(42u) == 42);
+		CPPUNIT_ASSERT(decode(encode(0xffffffffu)) == variant(0xffffffffu));
+		CPPUNIT_ASSERT(encode(0xffffffffu) != 0xffffffffu);
+
+		// lookups and comparisons run while another thread interns, across several chunks
+		std::vector<value> ids(5000);
+		bool ordered = true;
+		unsigned int i = 0;
+		std::thread writer([&](void)
+		{
+			for(unsigned int j = 0; j < ids.size(); ++j)
+				ids[j] = encode(std::string("sym") + std::to_string(j));
+		});
+
+		while(i < 20000)
+		{
+			ordered &= value_less(b,a) && !value_less(a,b) && decode(a) == variant(std::string("tom"));
+			++i;
+		}
+		writer.join();
+
+		CPPUNIT_ASSERT(ordered);
+		for(i = 0; i < ids.size(); ++i)
+			CPPUNIT_ASSERT(decode(ids[i]) == variant(std::string("sym") + std::to_string(i)));
+		CPPUNIT_ASSERT(value_less(ids[10],ids[9]) && value_less(ids[4000],ids[4001]));
+	}
+
+	void testIncremental(void)
+	{
+		parse edge("edge"), path("path"), move("move"), canMove("canMove"), winning("winning"), safe("safe"), hop("hop");
+
+		path("X"_dl,"Y"_dl) << edge("X"_dl,"Y"_dl);
+		path("X"_dl,"Y"_dl) << path("X"_dl,"Z"_dl),path("Z"_dl,"Y"_dl);
+
+		canMove("X"_dl) << move("X"_dl,"Y"_dl);
+		winning("X"_dl) << move("X"_dl,"Y"_dl),!canMove("Y"_dl);
+		winning("X"_dl) << move("X"_dl,"Y"_dl),edge("Y"_dl,"Z"_dl),winning("Z"_dl);
+		safe("X"_dl) << path("X"_dl,"Y"_dl),!winning("X"_dl);
+		hop("X"_dl,"W"_dl) << edge("X"_dl,"Y"_dl),move("Y"_dl,"Z"_dl),edge("Z"_dl,"W"_dl),!canMove("W"_dl);
+
+		std::multimap<std::string,rule_ptr> idb;
+		std::map<std::string,rel_ptr> edb;
+		rel_ptr edge_rel(new relation()), move_rel(new relation());
+
+		for(parse *p: {&path,&canMove,&winning,&safe,&hop})
+			std::for_each(p->rules.begin(),p->rules.end(),[&](rule_ptr r) { idb.insert(std::make_pair(r->head.name,r)); });
+
+		insert(edge_rel,1,2);
+		insert(edge_rel,2,3);
+		insert(move_rel,1,2);
+		edb.insert(std::make_pair("edge",edge_rel));
+		edb.insert(std::make_pair("move",move_rel));
+
+		database db(idb,edb);
+		unsigned int step = 0;
+		auto check = [&](void)
+		{
+			for(const std::string q: {"path","canMove","winning","safe","hop"})
+			{
+				rel_ptr exp = eval(q,idb,edb), got = db.query(q);
+
+				CPPUNIT_ASSERT(exp && got);
+				CPPUNIT_ASSERT(exp->rows().size() == got->rows().size());
+				for(const relation::row_view &row: exp->rows())
+					CPPUNIT_ASSERT(got->includes(row));
+			}
+		};
+
+		// mixed inserts and retracts, compared against evaluation from scratch after each step
+		while(step < 40)
+		{
+			unsigned int a = (step * 7) % 6 + 1, b = (step * 5 + 3) % 6 + 1;
+			relation::row r({encode(a),encode(b)});
+			const std::string name = step % 3 ? "edge" : "move";
+			rel_ptr rel = edb[name];
+
+			if(step % 4 == 3 && !rel->rows().empty())
+			{
+				relation::row old = *rel->rows().begin();
+
+				rel->remove(old);
+				db.retract(name,old);
+			}
+			else
+			{
+				rel->insert(r);
+				db.insert(name,r);
+			}
+
+			if(step % 2)
+				check();
+			++step;
+		}
+
+		// batches changing every atom of 'hop' at once
+		for(step = 0; step < 12; ++step)
+		{
+			unsigned int k = 0;
+
+			while(k < 6)
+			{
+				const std::string name = k % 3 == 1 ? "move" : "edge";
+				rel_ptr rel = edb[name];
+				relation::row r({encode((step + k * 5) % 7),encode((step * 3 + k) % 7)});
+
+				if((step + k) % 3 == 0 && !rel->rows().empty())
+				{
+					relation::row old = *rel->rows().begin();
+
+					rel->remove(old);
+					db.retract(name,old);
+				}
+				else if(rel->insert(r))
+					db.insert(name,r);
+				++k;
+			}
+			check();
+		}
+	}
+
+	void testDatabase(void)
+	{
+		parse edge("edge"), link("link"), path("path"), far("far"), unreachable("unreachable"), node("node");
+
+		path("X"_dl,"Y"_dl) << edge("X"_dl,"Y"_dl);
+		path("X"_dl,"Y"_dl) << path("X"_dl,"Z"_dl),edge("Z"_dl,"Y"_dl);
+		node("X"_dl) << edge("X"_dl,"Y"_dl);
+		node("Y"_dl) << edge("X"_dl,"Y"_dl);
+		unreachable("X"_dl,"Y"_dl) << node("X"_dl),node("Y"_dl),!path("X"_dl,"Y"_dl);
+		far("X"_dl) << link("X"_dl,"Y"_dl);
+
+		std::multimap<std::string,rule_ptr> idb;
+		std::map<std::string,rel_ptr> edb;
+		rel_ptr edge_rel(new relation()), link_rel(new relation());
+
+		for(parse *p: {&path,&node,&unreachable,&far})
+			std::for_each(p->rules.begin(),p->rules.end(),[&](rule_ptr r) { idb.insert(std::make_pair(r->head.name,r)); });
+
+		insert(edge_rel,1,2);
+		insert(edge_rel,2,3);
+		insert(link_rel,3,4);
+		insert(link_rel,4,1);
+		edb.insert(std::make_pair("edge",edge_rel));
+		edb.insert(std::make_pair("link",link_rel));
+
+		database db(idb,edb);
+		auto check = [&](const std::string &q)
+		{
+			rel_ptr exp = eval(q,idb,edb), got = db.query(q);
+
+			CPPUNIT_ASSERT(exp && got);
+			CPPUNIT_ASSERT(exp->rows().size() == got->rows().size());
+			for(const relation::row_view &row: exp->rows())
+				CPPUNIT_ASSERT(got->includes(row));
+		};
+
+		// repeated queries are answered from the materialized relations
+		rel_ptr first = db.query("unreachable");
+		CPPUNIT_ASSERT(first->rows().size() == 6);
+		CPPUNIT_ASSERT(db.query("unreachable") == first);
+		CPPUNIT_ASSERT(db.query("path") == db.query("path"));
+		check("unreachable");
+
+		// a new rule for 'path' drops 'path' and 'unreachable' but keeps 'far' and 'node'
+		rel_ptr far_rel = db.query("far"), node_rel = db.query("node");
+		parse path2("path");
+
+		path2("X"_dl,"Y"_dl) << path("X"_dl,"Z"_dl),link("Z"_dl,"Y"_dl);
+		CPPUNIT_ASSERT(db.insert(path2.rules.front()));
+		idb.insert(std::make_pair("path",path2.rules.front()));
+
+		check("path");
+		check("unreachable");
+		CPPUNIT_ASSERT(db.query("far") == far_rel);
+		CPPUNIT_ASSERT(db.query("node") == node_rel);
+
+		// facts after a rule change
+		db.insert("edge",relation::row({encode(4u),encode(5u)}));
+		insert(edge_rel,4,5);
+		check("unreachable");
+		check("path");
+
+		CPPUNIT_ASSERT(db.retract(path2.rules.front()));
+		CPPUNIT_ASSERT(!db.retract(path2.rules.front()));
+		idb.erase(std::find_if(idb.begin(),idb.end(),[&](const std::pair<const std::string,rule_ptr> &p) { return p.second == path2.rules.front(); }));
+
+		check("path");
+		check("unreachable");
+		check("far");
+	}
+
+	void testTrace(void)
+	{
+		struct counter : public tracer
+		{
+			counter(void) : strata(0), iterations(0), rules(0), tuples(0) {}
+
+			virtual void skipped(const std::string &pred) { skip.insert(pred); }
+			virtual void stratum(const std::set<std::string> &) { ++strata; }
+			virtual void iteration(unsigned int n) { iterations = std::max(iterations,n); }
+			virtual void rule_finish(const rule_ptr, const rel_ptr, const rule_stats &) { ++rules; }
+			virtual void delta(const std::string &, size_t rows) { tuples += rows; }
+
+			std::set<std::string> skip;
+			unsigned int strata, iterations, rules;
+			size_t tuples;
+		};
+
+		rel_ptr edge_rel(new relation());
+		unsigned int i = 1;
+
+		while(i < 6)
+		{
+			insert(edge_rel,i,i + 1);
+			++i;
+		}
+
+		parse edge("edge"), path("path"), loop("loop");
+
+		path("X"_dl,"Y"_dl) << edge("X"_dl,"Y"_dl);
+		path("X"_dl,"Y"_dl) << path("X"_dl,"Z"_dl),edge("Z"_dl,"Y"_dl);
+		loop("X"_dl) << path("X"_dl,"X"_dl);
+
+		std::map<std::string,rel_ptr> edb;
+		std::multimap<std::string,rule_ptr> idb;
+
+		std::for_each(path.rules.begin(),path.rules.end(),[&](rule_ptr r) { idb.insert(std::make_pair(r->head.name,r)); });
+		std::for_each(loop.rules.begin(),loop.rules.end(),[&](rule_ptr r) { idb.insert(std::make_pair(r->head.name,r)); });
+		edb.insert(std::make_pair("edge",edge_rel));
+
+		counter cnt;
+		eval_options opts;
+
+		opts.trace = &cnt;
+		rel_ptr res = eval("path",idb,edb,opts);
+
+		CPPUNIT_ASSERT(res && res->rows().size() == 15);
+		CPPUNIT_ASSERT(cnt.skip == std::set<std::string>({"loop"}));
+		CPPUNIT_ASSERT(cnt.strata == 1);
+		CPPUNIT_ASSERT(cnt.iterations == 5);
+		CPPUNIT_ASSERT(cnt.tuples == 10);	// the first 5 come from the non-recursive rule
+		CPPUNIT_ASSERT(cnt.rules == 6);	// once per iteration and the non-recursive rule
+
+		profiler prof;
+		std::ostringstream dump;
+
+		opts.trace = &prof;
+		opts.threads = 2;
+		opts.partition = 1;
+		res = eval("path",idb,edb,opts);
+
+		CPPUNIT_ASSERT(res && res->rows().size() == 15);
+		CPPUNIT_ASSERT(prof.report().size() == 1);
+
+		const profiler::stratum_entry &st = prof.report().front();
+		size_t fresh = 0;
+
+		CPPUNIT_ASSERT(st.iterations == 5);
+		CPPUNIT_ASSERT(st.rules.size() == 2);
+		for(const profiler::rule_entry &e: st.rules)
+		{
+			fresh += e.fresh;
+			CPPUNIT_ASSERT(e.produced >= e.fresh);
+			if(e.rule->body.size() == 1)
+				CPPUNIT_ASSERT(e.calls == 1 && e.produced == 5);
+			else
+				CPPUNIT_ASSERT(e.calls == 5 && e.probes > 0 && e.peak > 0);
+		}
+		CPPUNIT_ASSERT(fresh == 15);
+
+		dump << prof;
+		CPPUNIT_ASSERT(dump.str().find("stratum {path}") == 0);
+	}
+
+	void testTyped(void)
+	{
+		typed_relation<std::string,unsigned int> parent;
+
+		CPPUNIT_ASSERT(parent.insert("tom",1));
+		CPPUNIT_ASSERT(parent.insert("amy",2));
+		CPPUNIT_ASSERT(!parent.insert("tom",1));
+		CPPUNIT_ASSERT(parent.insert("tom",0x80000001));
+		CPPUNIT_ASSERT(parent.size() == 3);
+		CPPUNIT_ASSERT(parent.includes("amy",2) && !parent.includes("amy",1));
+		CPPUNIT_ASSERT(std::get<0>(parent[1]) == "amy" && std::get<1>(parent[2]) == 0x80000001);
+
+		// same encoding as the variant based insert()
+		rel_ptr untyped(new relation());
+		insert(untyped,"tom",1u);
+		CPPUNIT_ASSERT(parent.untyped()->includes(*untyped->rows().begin()));
+
+		typed_relation<unsigned int,unsigned int> edge;
+		unsigned int i = 1;
+
+		while(i < 6)
+		{
+			edge.insert(i,i + 1);
+			++i;
+		}
+
+		parse e("edge"), path("path");
+
+		path("X"_dl,"Y"_dl) << e("X"_dl,"Y"_dl);
+		path("X"_dl,"Y"_dl) << e("X"_dl,"Z"_dl),path("Z"_dl,"Y"_dl);
+
+		std::map<std::string,rel_ptr> edb;
+		std::multimap<std::string,rule_ptr> idb;
+
+		std::for_each(path.rules.begin(),path.rules.end(),[&](rule_ptr r) { idb.insert(std::make_pair(r->head.name,r)); });
+		edb.insert(std::make_pair("edge",edge));
+
+		typed_relation<unsigned int,unsigned int> res(eval(path(1u,"Y"_dl),idb,edb));
+		std::set<unsigned int> reached;
+
+		CPPUNIT_ASSERT(res.size() == 5);
+		for(const std::tuple<unsigned int,unsigned int> &t: res)
+		{
+			CPPUNIT_ASSERT(std::get<0>(t) == 1);
+			reached.insert(std::get<1>(t));
+		}
+		CPPUNIT_ASSERT(reached == std::set<unsigned int>({2,3,4,5,6}));
+	}
+
+	void testSnapshot(void)
+	{
+		char path[] = "/tmp/dlog-snapshot-XXXXXX";
+		const int fd = mkstemp(path);
+		rel_ptr rel(new relation());
+		unsigned int i = 0;
+
+		CPPUNIT_ASSERT(fd >= 0);
+		close(fd);
+
+		while(i < 100)
+		{
+			insert(rel,i,std::string("n") + std::to_string(i % 7),i * 3);
+			++i;
+		}
+		insert(rel,0x80000005u,"big",1u);
+		rel->find({variable(false,"","X"),bound(std::string("n3")),variable(false,"","Y")});
+
+		CPPUNIT_ASSERT(save_snapshot(*rel,path));
+
+		rel_ptr snap = load_snapshot(path,true);
+
+		CPPUNIT_ASSERT(snap);
+		CPPUNIT_ASSERT(snap->arity() == 3 && snap->rows().size() == 101);
+		CPPUNIT_ASSERT(snap->indices() == rel->indices());
+		for(const relation::row_view &r: rel->rows())
+			CPPUNIT_ASSERT(snap->includes(r));
+		CPPUNIT_ASSERT(snap->find({variable(false,"","X"),bound(std::string("n3")),variable(false,"","Y")}).size() == 14);
+		CPPUNIT_ASSERT(decode(snap->rows()[100][0]) == variant(0x80000005u));
+
+		// modifications copy the mapped columns
+		insert(snap,1000u,"new",1u);
+		CPPUNIT_ASSERT(snap->rows().size() == 102);
+		CPPUNIT_ASSERT(snap->remove(*rel->rows().begin()));
+		CPPUNIT_ASSERT(!snap->includes(*rel->rows().begin()));
+		CPPUNIT_ASSERT(snap->find({bound(1000u),variable(false,"","X"),variable(false,"","Y")}).size() == 1);
+
+		// bulk inserts larger than the capacity of the columns, starting w/ known rows
+		rel_ptr batch(new relation());
+
+		batch->insert(rel);
+		for(i = 0; i < 1000; ++i)
+			insert(batch,i + 2000,"batch",i);
+
+		rel_ptr mapped = load_snapshot(path);
+
+		CPPUNIT_ASSERT(mapped && mapped->insert(batch));
+		CPPUNIT_ASSERT(mapped->rows().size() == 1101);
+		CPPUNIT_ASSERT(snap->insert(batch));
+		CPPUNIT_ASSERT(snap->rows().size() == 1102);
+		for(const relation::row_view &r: batch->rows())
+			CPPUNIT_ASSERT(mapped->includes(r) && snap->includes(r));
+
+		CPPUNIT_ASSERT(!load_snapshot("/nonexistent/snapshot"));
+
+		// corrupt headers and ids, 'at' is a byte offset into the file
+		auto corrupt = [&](size_t at, const void *data, size_t len)
+		{
+			std::fstream fs(path,std::ios::in | std::ios::out | std::ios::binary);
+			fs.seekp(at);
+			fs.write(static_cast<const char *>(data),len);
+		};
+		const uint64_t huge = 1ull << 62;
+		const uint32_t bogus = 0xffffffff;
+		uint64_t columns, nsym, nmask;
+		value second;
+
+		// only the 9 symbols used by 'rel' are written, not every one interned so far
+		CPPUNIT_ASSERT(save_snapshot(*rel,path));
+		{
+			std::ifstream is(path,std::ios::binary);
+			is.seekg(24);
+			is.read(reinterpret_cast<char *>(&nsym),sizeof(nsym));
+			is.read(reinterpret_cast<char *>(&nmask),sizeof(nmask));
+		}
+		CPPUNIT_ASSERT(nsym == 9 && symbols().size() > nsym);
+		corrupt(48 + nmask * 8 + 4,&bogus,sizeof(bogus));		// limit of the 2nd column
+		CPPUNIT_ASSERT(!load_snapshot(path));
+
+		CPPUNIT_ASSERT(save_snapshot(*rel,path));
+		corrupt(16,&huge,sizeof(huge));		// rows
+		CPPUNIT_ASSERT(!load_snapshot(path));
+		CPPUNIT_ASSERT(save_snapshot(*rel,path));
+		corrupt(24,&huge,sizeof(huge));		// symbols
+		CPPUNIT_ASSERT(!load_snapshot(path));
+		CPPUNIT_ASSERT(save_snapshot(*rel,path));
+		corrupt(32,&huge,sizeof(huge));		// masks
+		CPPUNIT_ASSERT(!load_snapshot(path));
+		CPPUNIT_ASSERT(save_snapshot(*rel,path));
+		{
+			std::ifstream is(path,std::ios::binary);
+			is.seekg(40);
+			is.read(reinterpret_cast<char *>(&columns),sizeof(columns));
+			is.seekg(columns + 4);
+			is.read(reinterpret_cast<char *>(&second),sizeof(second));
+		}
+		CPPUNIT_ASSERT(second == rel->rows()[1][0]);
+		corrupt(columns + 4,&bogus,sizeof(bogus));		// 2nd row of the 1st column, beyond its limit
+		CPPUNIT_ASSERT(!load_snapshot(path));
+		CPPUNIT_ASSERT(save_snapshot(*rel,path) && load_snapshot(path));
+
+		unlink(path);
+	}
+
+	void testLoadFacts(void)
+	{
+		char path[] = "/tmp/dlog-facts-XXXXXX";
+		const int fd = mkstemp(path);
+		std::ofstream os;
+		unsigned int i = 0;
+
+		CPPUNIT_ASSERT(fd >= 0);
+		close(fd);
+
+		// 2000 distinct tuples, each twice, w/ CRLF endings and a blank line
+		os.open(path);
+		while(i < 4000)
+		{
+			os << (i % 2000) / 10 << "\t" << "node" << (i % 2000) % 10 << (i % 3 ? "\n" : "\r\n");
+			if(i == 1234)
+				os << "\n";
+			++i;
+		}
+		os << "4294967295\tbig";
+		os.close();
+
+		load_options opts;
+		opts.chunk = 1000;
+		opts.threads = 4;
+
+		rel_ptr rel = load_facts(path,opts);
+
+		CPPUNIT_ASSERT(rel);
+		CPPUNIT_ASSERT(rel->arity() == 2 && rel->rows().size() == 2001);
+		for(i = 0; i < 2000; ++i)
+			CPPUNIT_ASSERT(rel->includes(relation::row({encode(i / 10),encode(std::string("node") + std::to_string(i % 10))})));
+		CPPUNIT_ASSERT(rel->includes(relation::row({encode(4294967295u),encode(std::string("big"))})));
+		CPPUNIT_ASSERT(rel->find({bound(7u),variable(false,"","X")}).size() == 10);
+
+		// same result w/ a single thread
+		opts.threads = 1;
+		rel_ptr seq = load_facts(path,opts);
+		CPPUNIT_ASSERT(seq && seq->rows().size() == 2001);
+
+		// inconsistent arity
+		os.open(path);
+		os << "1,2\n3,4,5\n";
+		os.close();
+		opts.delimiter = ',';
+		CPPUNIT_ASSERT(!load_facts(path,opts));
+
+		unlink(path);
+		CPPUNIT_ASSERT(!load_facts(path,opts));
+	}
+
+	void testStream(void)
+	{
+		struct iterations : public tracer
+		{
+			iterations(void) : count(0) {}
+			virtual void iteration(unsigned int n) { count = std::max(count,n); }
+			unsigned int count;
+		};
+
+		rel_ptr edge_rel(new relation());
+		unsigned int i = 0;
+
+		while(i < 50)
+		{
+			insert(edge_rel,i,i + 1);
+			++i;
+		}
+
+		parse edge("edge"), path("path"), cycle("cycle");
+
+		path("X"_dl,"Y"_dl) << edge("X"_dl,"Y"_dl);
+		path("X"_dl,"Y"_dl) << path("X"_dl,"Z"_dl),edge("Z"_dl,"Y"_dl);
+		cycle("X"_dl) << path("X"_dl,"X"_dl);
+
+		std::map<std::string,rel_ptr> edb;
+		std::multimap<std::string,rule_ptr> idb;
+
+		std::for_each(path.rules.begin(),path.rules.end(),[&](rule_ptr r) { idb.insert(std::make_pair(r->head.name,r)); });
+		std::for_each(cycle.rules.begin(),cycle.rules.end(),[&](rule_ptr r) { idb.insert(std::make_pair(r->head.name,r)); });
+		edb.insert(std::make_pair("edge",edge_rel));
+
+		// stops before the fixpoint is reached
+		iterations it;
+		eval_options opts;
+		std::set<std::pair<unsigned int,unsigned int>> seen;
+
+		opts.trace = &it;
+		CPPUNIT_ASSERT(stream("path",idb,edb,[&](const relation::row_view &r)
+		{
+			seen.insert(std::make_pair(boost::get<unsigned int>(cursor::get(r,0)),boost::get<unsigned int>(cursor::get(r,1))));
+			return true;
+		},60,opts) == 60);
+		CPPUNIT_ASSERT(seen.size() == 60);
+		CPPUNIT_ASSERT(it.count == 1);
+
+		CPPUNIT_ASSERT(stream("path",idb,edb,[](const relation::row_view &) { return true; }) == 50 * 51 / 2);
+		CPPUNIT_ASSERT(stream("edge",idb,edb,[](const relation::row_view &) { return true; },7) == 7);
+		CPPUNIT_ASSERT(exists("path",idb,edb));
+		CPPUNIT_ASSERT(!exists("cycle",idb,edb));
+
+		// batches
+		cursor cur(eval("path",idb,edb),1000);
+		std::vector<relation::row_view> batch;
+		unsigned int batches = 0;
+
+		while(cur.next(batch,300))
+			++batches;
+		CPPUNIT_ASSERT(batches == 4 && cur.position() == 1000);
+	}
+
+	void testNegation(void)
+	{
+		std::set<std::pair<unsigned int,unsigned int>> edges, blocked;
+		std::set<unsigned int> red;
+		rel_ptr edge_rel(new relation()), blocked_rel(new relation()), color_rel(new relation());
+		unsigned int i = 0;
+
+		while(i < 30)
+		{
+			edges.insert(std::make_pair(i,(i * 7 + 3) % 30));
+			edges.insert(std::make_pair(i,(i * 11 + 5) % 30));
+			if(i % 4 == 0)
+				blocked.insert(std::make_pair(i,(i * 7 + 3) % 30));
+			if(i % 5 == 0)
+				blocked.insert(std::make_pair(i,i));
+			insert(color_rel,i,std::string(i % 3 ? "blue" : "red"));
+			if(i % 3 == 0)
+				red.insert(i);
+			++i;
+		}
+		for(const std::pair<unsigned int,unsigned int> &e: edges)
+			insert(edge_rel,e.first,e.second);
+		for(const std::pair<unsigned int,unsigned int> &b: blocked)
+			insert(blocked_rel,b.first,b.second);
+
+		parse edge("edge"), blk("blocked"), color("color"), open("open"), two("two"), three("three");
+		variable X = "X"_dl, Y = "Y"_dl, Z = "Z"_dl, W = "W"_dl;
+
+		open(X,Y) << edge(X,Y),!blk(X,Y);
+		two(X,Z) << edge(X,Y),edge(Y,Z),!blk(X,Z),!color(Y,std::string("red"));
+		three(X,W) << edge(X,Y),edge(Y,Z),edge(Z,W),!blk(Y,Y),X < W;
+
+		std::map<std::string,rel_ptr> edb;
+		std::multimap<std::string,rule_ptr> idb;
+
+		for(parse *p: {&open,&two,&three})
+			std::for_each(p->rules.begin(),p->rules.end(),[&](rule_ptr r) { idb.insert(std::make_pair(r->head.name,r)); });
+		edb.insert(std::make_pair("edge",edge_rel));
+		edb.insert(std::make_pair("blocked",blocked_rel));
+		edb.insert(std::make_pair("color",color_rel));
+
+		std::set<std::pair<unsigned int,unsigned int>> exp_open, exp_two, exp_three;
+
+		for(const std::pair<unsigned int,unsigned int> &a: edges)
+		{
+			if(!blocked.count(a))
+				exp_open.insert(a);
+			for(const std::pair<unsigned int,unsigned int> &b: edges)
+			{
+				if(a.second != b.first)
+					continue;
+				if(!blocked.count(std::make_pair(a.first,b.second)) && !red.count(b.first))
+					exp_two.insert(std::make_pair(a.first,b.second));
+				for(const std::pair<unsigned int,unsigned int> &c: edges)
+					if(b.second == c.first && !blocked.count(std::make_pair(b.first,b.first)) && a.first < c.second)
+						exp_three.insert(std::make_pair(a.first,c.second));
+			}
+		}
+
+		for(rule::Join j: {rule::Pairwise,rule::Leapfrog})
+		{
+			eval_options opts;
+			opts.join = j;
+
+			for(const std::pair<std::string,std::set<std::pair<unsigned int,unsigned int>>*> &q: {std::make_pair(std::string("open"),&exp_open),std::make_pair(std::string("two"),&exp_two),std::make_pair(std::string("three"),&exp_three)})
+			{
+				rel_ptr res = eval(q.first,idb,edb,opts);
+
+				CPPUNIT_ASSERT(res && res->rows().size() == q.second->size());
+				for(const std::pair<unsigned int,unsigned int> &t: *q.second)
+					CPPUNIT_ASSERT(res->includes(relation::row({encode(t.first),encode(t.second)})));
+			}
+		}
+
+		// the only positive atom is empty
+		parse none("none"), unblocked("unblocked"), small("small");
+		rel_ptr none_rel(new relation());
+
+		unblocked(X,Y) << none(X,Y),!blk(X,Y);
+		small(X) << none(X,Y),X < 5u;
+		for(parse *p: {&unblocked,&small})
+			std::for_each(p->rules.begin(),p->rules.end(),[&](rule_ptr r) { idb.insert(std::make_pair(r->head.name,r)); });
+		edb.insert(std::make_pair("none",none_rel));
+
+		rel_ptr res = eval("unblocked",idb,edb);
+		CPPUNIT_ASSERT(res && res->rows().empty());
+		res = eval("small",idb,edb);
+		CPPUNIT_ASSERT(res && res->rows().empty());
+	}
+
+	void testStratify(void)
+	{
+		const unsigned int n = 500;
+		std::list<parse> chain;
+		std::multimap<std::string,rule_ptr> idb;
+		std::map<std::string,rel_ptr> edb;
+		variable X = "X"_dl;
+		rel_ptr e_rel(new relation());
+		unsigned int i = 0;
+
+		insert(e_rel,1);
+		insert(e_rel,2);
+		edb.insert(std::make_pair("e",e_rel));
+
+		// p0 :- e, p(i) :- p(i - 1)
+		parse e("e");
+		while(i <= n)
+		{
+			chain.push_back(parse("p" + std::to_string(i)));
+			if(i == 0)
+				chain.back()(X) << e(X);
+			else
+				chain.back()(X) << (*std::prev(chain.end(),2))(X);
+			++i;
+		}
+
+		parse a("a"), b("b"), c("c"), none("none");
+
+		a(X) << chain.back()(X);
+		a(X) << b(X);
+		b(X) << a(X);
+		c(X) << e(X),b(X);
+		none(X) << e(X),!c(X);
+
+		for(parse &p: chain)
+			std::for_each(p.rules.begin(),p.rules.end(),[&](rule_ptr r) { idb.insert(std::make_pair(r->head.name,r)); });
+		for(parse *p: {&a,&b,&c,&none})
+			std::for_each(p->rules.begin(),p->rules.end(),[&](rule_ptr r) { idb.insert(std::make_pair(r->head.name,r)); });
+
+		const dependency_graph graph(idb);
+		std::set<std::string> preds;
+
+		for(const std::pair<const std::string,rule_ptr> &p: idb)
+			preds.insert(p.first);
+
+		const std::list<std::set<std::string>> strata = graph.stratify(preds);
+
+		CPPUNIT_ASSERT(graph.cycles().empty());
+		CPPUNIT_ASSERT(strata.size() == n + 4);
+		CPPUNIT_ASSERT(strata.front() == std::set<std::string>({"p0"}));
+		CPPUNIT_ASSERT(*std::prev(strata.end(),3) == std::set<std::string>({"a","b"}));
+		CPPUNIT_ASSERT(strata.back() == std::set<std::string>({"none"}));
+		CPPUNIT_ASSERT(graph.depends("c").size() == n + 5);
+		CPPUNIT_ASSERT(graph.depends("e") == std::set<std::string>({"e"}));
+
+		// the graph is reused across calls
+		eval_options opts;
+		opts.graph = &graph;
+
+		rel_ptr res = eval("c",idb,edb,opts);
+		CPPUNIT_ASSERT(res && res->rows().size() == 2);
+		res = eval("none",idb,edb,opts);
+		CPPUNIT_ASSERT(res && res->rows().empty());
+
+		// negation inside a recursive component
+		parse win("win");
+
+		win(X) << e(X),!win(X);
+		idb.insert(std::make_pair("win",win.rules.front()));
+		CPPUNIT_ASSERT(dependency_graph(idb).cycles().size() == 1);
+		CPPUNIT_ASSERT(!eval("win",idb,edb));
+		CPPUNIT_ASSERT(eval("c",idb,edb));
+	}
+
+	void testAggregates(void)
+	{
+		const unsigned int n = 20;
+		std::map<std::pair<unsigned int,unsigned int>,unsigned int> edges; // weights are unique
+		rel_ptr edge_rel(new relation());
+		unsigned int i = 0;
+
+		while(i < n)
+		{
+			if(i % 5 != 4)
+				edges[std::make_pair(i,(i + 1) % n)] = 2 * i + 1;
+			edges[std::make_pair(i,(i * 3 + 1) % n)] = 2 * i + 2;
+			++i;
+		}
+		for(const std::pair<const std::pair<unsigned int,unsigned int>,unsigned int> &e: edges)
+			insert(edge_rel,e.first.first,e.first.second,e.second);
+
+		parse edge("edge"), wide("wide"), low("low"), degree("degree"), total("total"), loop("loop");
+		variable X = "X"_dl, Y = "Y"_dl, Z = "Z"_dl, W = "W"_dl, W1 = "W1"_dl, W2 = "W2"_dl, M = "M"_dl;
+
+		// widest path: the greatest bottleneck over all paths
+		wide(X,Y,agg::max(W)) << edge(X,Y,W);
+		wide(X,Y,agg::max(W1)) << wide(X,Z,W1),edge(Z,Y,W2),W1 <= W2;
+		wide(X,Y,agg::max(W2)) << wide(X,Z,W1),edge(Z,Y,W2),W2 < W1;
+		low(X,agg::min(Y)) << edge(X,Y,W);
+		low(X,agg::min(M)) << edge(X,Y,W),low(Y,M);
+		degree(X,agg::count(Y)) << edge(X,Y,W);
+		total(X,agg::sum(W)) << edge(X,Y,W);
+
+		std::stringstream ss;
+		ss << *wide.rules.front();
+		CPPUNIT_ASSERT(ss.str().find("max(W)") != std::string::npos);
+
+		std::multimap<std::string,rule_ptr> idb;
+		std::map<std::string,rel_ptr> edb;
+
+		for(parse *p: {&wide,&low,&degree,&total})
+			std::for_each(p->rules.begin(),p->rules.end(),[&](rule_ptr r) { idb.insert(std::make_pair(r->head.name,r)); });
+		edb.insert(std::make_pair("edge",edge_rel));
+
+		// expected values by relaxation until nothing changes
+		std::map<std::pair<unsigned int,unsigned int>,unsigned int> exp_wide(edges);
+		std::map<unsigned int,unsigned int> exp_low, exp_degree, exp_total;
+		bool changed = true;
+
+		for(const std::pair<const std::pair<unsigned int,unsigned int>,unsigned int> &e: edges)
+		{
+			exp_low[e.first.first] = exp_low.count(e.first.first) ? std::min(exp_low[e.first.first],e.first.second) : e.first.second;
+			exp_degree[e.first.first] += 1;
+			exp_total[e.first.first] += e.second;
+		}
+
+		while(changed)
+		{
+			changed = false;
+			for(const std::pair<const std::pair<unsigned int,unsigned int>,unsigned int> &e: edges)
+			{
+				for(const std::pair<const std::pair<unsigned int,unsigned int>,unsigned int> &w: std::map<std::pair<unsigned int,unsigned int>,unsigned int>(exp_wide))
+				{
+					if(w.first.second != e.first.first)
+						continue;
+
+					const std::pair<unsigned int,unsigned int> xy(w.first.first,e.first.second);
+					const unsigned int b = std::min(w.second,e.second);
+
+					if(!exp_wide.count(xy) || exp_wide[xy] < b)
+					{
+						exp_wide[xy] = b;
+						changed = true;
+					}
+				}
+
+				if(exp_low.count(e.first.second) && exp_low[e.first.second] < exp_low[e.first.first])
+				{
+					exp_low[e.first.first] = exp_low[e.first.second];
+					changed = true;
+				}
+			}
+		}
+
+		for(rule::Join j: {rule::Pairwise,rule::Leapfrog})
+		{
+			eval_options opts;
+			opts.join = j;
+
+			// one tuple per group
+			rel_ptr res = eval("wide",idb,edb,opts);
+			CPPUNIT_ASSERT(res && res->rows().size() == exp_wide.size());
+			for(const std::pair<const std::pair<unsigned int,unsigned int>,unsigned int> &w: exp_wide)
+				CPPUNIT_ASSERT(res->includes(relation::row({encode(w.first.first),encode(w.first.second),encode(w.second)})));
+
+			res = eval("low",idb,edb,opts);
+			CPPUNIT_ASSERT(res && res->rows().size() == exp_low.size());
+			for(const std::pair<const unsigned int,unsigned int> &l: exp_low)
+				CPPUNIT_ASSERT(res->includes(relation::row({encode(l.first),encode(l.second)})));
+		}
+
+		rel_ptr res = eval("degree",idb,edb);
+		CPPUNIT_ASSERT(res && res->rows().size() == exp_degree.size());
+		for(const std::pair<const unsigned int,unsigned int> &d: exp_degree)
+			CPPUNIT_ASSERT(res->includes(relation::row({encode(d.first),encode(d.second)})));
+
+		res = eval("total",idb,edb);
+		CPPUNIT_ASSERT(res && res->rows().size() == exp_total.size());
+		for(const std::pair<const unsigned int,unsigned int> &t: exp_total)
+			CPPUNIT_ASSERT(res->includes(relation::row({encode(t.first),encode(t.second)})));
+
+		// every employee counts, even w/ the same salary as another one in the department
+		rel_ptr emp_rel(new relation());
+		parse emp("emp"), payroll("payroll"), staff("staff");
+		variable N = "N"_dl, D = "D"_dl, S = "S"_dl;
+
+		insert(emp_rel,std::string("ann"),std::string("dev"),100u);
+		insert(emp_rel,std::string("bob"),std::string("dev"),100u);
+		insert(emp_rel,std::string("cy"),std::string("dev"),50u);
+		insert(emp_rel,std::string("dee"),std::string("ops"),70u);
+		edb.insert(std::make_pair("emp",emp_rel));
+
+		payroll(D,agg::sum(S)) << emp(N,D,S);
+		staff(D,agg::count(S)) << emp(N,D,S);
+		for(parse *p: {&payroll,&staff})
+			idb.insert(std::make_pair(p->name,p->rules.front()));
+
+		res = eval("payroll",idb,edb);
+		CPPUNIT_ASSERT(res && res->rows().size() == 2);
+		CPPUNIT_ASSERT(res->includes(relation::row({encode(std::string("dev")),encode(250u)})));
+		CPPUNIT_ASSERT(res->includes(relation::row({encode(std::string("ops")),encode(70u)})));
+		res = eval("staff",idb,edb);
+		CPPUNIT_ASSERT(res && res->rows().size() == 2);
+		CPPUNIT_ASSERT(res->includes(relation::row({encode(std::string("dev")),encode(3u)})));
+
+		// streams see the final values only
+		std::set<std::pair<unsigned int,unsigned int>> seen;
+
+		stream("low",idb,edb,[&](const relation::row_view &r)
+		{
+			seen.insert(std::make_pair(boost::get<unsigned int>(cursor::get(r,0)),boost::get<unsigned int>(cursor::get(r,1))));
+			return true;
+		});
+		CPPUNIT_ASSERT(seen.size() == exp_low.size());
+
+		// a new edge improves the materialized aggregates
+		database db(idb,edb);
+
+		CPPUNIT_ASSERT(db.query("wide")->rows().size() == exp_wide.size());
+		db.insert("edge",relation::row({encode(0u),encode(5u),encode(100u)}));
+		res = db.query("wide");
+		CPPUNIT_ASSERT(res->includes(relation::row({encode(0u),encode(5u),encode(100u)})));
+
+		std::map<std::string,rel_ptr> edb2({std::make_pair("edge",db.query("edge"))});
+		rel_ptr exp = eval("wide",idb,edb2);
+
+		CPPUNIT_ASSERT(exp && res->rows().size() == exp->rows().size());
+		for(const relation::row_view &row: exp->rows())
+			CPPUNIT_ASSERT(res->includes(row));
+
+		res = db.query("degree");
+		CPPUNIT_ASSERT(res->includes(relation::row({encode(0u),encode(exp_degree[0] + 1)})));
+		CPPUNIT_ASSERT(!res->includes(relation::row({encode(0u),encode(exp_degree[0])})));
+
+		// counting through recursion isn't stratifiable
+		loop(X,agg::count(Y)) << edge(X,Y,W),loop(Y,M);
+		idb.insert(std::make_pair("loop",loop.rules.front()));
+		CPPUNIT_ASSERT(!eval("loop",idb,edb));
 	}
 };
@@ -0,0 +1,137 @@
+#ifndef TYPED_HH
+#define TYPED_HH
+
+#include <tuple>
+#include <array>
+#include <type_traits>
+
+#include "dlog.hh"
+
+// Encoding of statically typed values. Same ids as encode(variant) w/o the runtime
+// type dispatch.
+inline value encode_as(unsigned int v)
+{
+	return v & 0x80000000 ? symbols().intern(variant(v)) : v;
+}
+
+inline value encode_as(const std::string &s)
+{
+	return symbols().intern(variant(s));
+}
+
+inline value encode_as(const char *s)
+{
+	return encode_as(std::string(s));
+}
+
+template<typename T>
+T decode_as(value v);
+
+template<>
+inline unsigned int decode_as<unsigned int>(value v)
+{
+	return v & 0x80000000 ? boost::get<unsigned int>(symbols().lookup(v)) : v;
+}
+
+template<>
+inline std::string decode_as<std::string>(value v)
+{
+	return boost::get<std::string>(symbols().lookup(v));
+}
+
+// decodes the first I columns of a row into a tuple
+template<unsigned int I, typename... Ts>
+struct typed_row
+{
+	static void decode(std::tuple<Ts...> &t, const relation::row_view &r)
+	{
+		std::get<I - 1>(t) = decode_as<typename std::tuple_element<I - 1,std::tuple<Ts...>>::type>(r[I - 1]);
+		typed_row<I - 1,Ts...>::decode(t,r);
+	}
+};
+
+template<typename... Ts>
+struct typed_row<0,Ts...>
+{
+	static void decode(std::tuple<Ts...> &, const relation::row_view &) {}
+};
+
+// true if all column types are supported
+template<typename... Ts>
+struct typed_columns : std::true_type {};
+
+template<typename T, typename... Ts>
+struct typed_columns<T,Ts...> : std::integral_constant<bool,(std::is_same<T,unsigned int>::value || std::is_same<T,std::string>::value) && typed_columns<Ts...>::value> {};
+
+// Relation w/ a fixed arity and column types (unsigned int or std::string). Rows are
+// encoded into std::array<value,N> on the stack and stored in an ordinary relation,
+// so typed relations convert to rel_ptr for eval() and the EDB map and wrap the
+// relations returned by eval().
+template<typename... Ts>
+class typed_relation
+{
+public:
+	typedef std::tuple<Ts...> tuple;
+	static const unsigned int width = sizeof...(Ts);
+
+	class iterator
+	{
+	public:
+		iterator(const relation *r, unsigned int i) : m_rel(r), m_index(i) {}
+
+		tuple operator*(void) const
+		{
+			tuple ret;
+			typed_row<width,Ts...>::decode(ret,m_rel->rows()[m_index]);
+			return ret;
+		}
+
+		iterator &operator++(void) { ++m_index; return *this; }
+		bool operator==(const iterator &i) const { return m_index == i.m_index; }
+		bool operator!=(const iterator &i) const { return m_index != i.m_index; }
+
+	private:
+		const relation *m_rel;
+		unsigned int m_index;
+	};
+
+	typed_relation(void)
+	: m_rel(new relation(width))
+	{
+		return;
+	}
+
+	typed_relation(rel_ptr r)
+	: m_rel(r)
+	{
+		assert(r && (r->rows().empty() || r->arity() == width));
+	}
+
+	bool insert(const Ts&... args)
+	{
+		const std::array<value,width> r = {{encode_as(args)...}};
+		return m_rel->insert(r);
+	}
+
+	bool includes(const Ts&... args) const
+	{
+		const std::array<value,width> r = {{encode_as(args)...}};
+		return m_rel->includes(r);
+	}
+
+	tuple operator[](unsigned int i) const { return *iterator(m_rel.get(),i); }
+	size_t size(void) const { return m_rel->rows().size(); }
+	iterator begin(void) const { return iterator(m_rel.get(),0); }
+	iterator end(void) const { return iterator(m_rel.get(),m_rel->rows().size()); }
+
+	rel_ptr untyped(void) const { return m_rel; }
+	operator rel_ptr(void) const { return m_rel; }
+
+private:
+	static_assert(width > 0 && width <= 64,"arity must be in [1,64]");
+	static_assert(typed_columns<Ts...>::value,"columns must be unsigned int or std::string");
+
+	rel_ptr m_rel;
+};
+
+#endif